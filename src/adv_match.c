@@ -0,0 +1,105 @@
+/* adv_match.c - In-place advertising data matcher */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "adv_match.h"
+
+static bool is_name(uint8_t ad_type)
+{
+	return ad_type == BT_DATA_NAME_COMPLETE || ad_type == BT_DATA_NAME_SHORTENED;
+}
+
+static bool field_matches(const struct adv_match_rule *rule, uint8_t ad_type,
+			  const uint8_t *data, uint8_t data_len)
+{
+	switch (rule->type) {
+	case ADV_MATCH_TYPE_NAME:
+		return ad_type == BT_DATA_NAME_COMPLETE && data_len == rule->len &&
+		       memcmp(data, rule->data, rule->len) == 0;
+
+	case ADV_MATCH_TYPE_NAME_PREFIX:
+		return is_name(ad_type) && data_len >= rule->len &&
+		       memcmp(data, rule->data, rule->len) == 0;
+
+	case ADV_MATCH_TYPE_UUID16:
+		if (ad_type != BT_DATA_UUID16_SOME && ad_type != BT_DATA_UUID16_ALL) {
+			return false;
+		}
+		for (uint8_t i = 0; i + 1 < data_len; i += 2) {
+			if (sys_get_le16(&data[i]) == rule->uuid16) {
+				return true;
+			}
+		}
+		return false;
+
+	case ADV_MATCH_TYPE_MANUFACTURER:
+		return ad_type == BT_DATA_MANUFACTURER_DATA && data_len >= rule->len &&
+		       memcmp(data, rule->data, rule->len) == 0;
+
+	default:
+		return false;
+	}
+}
+
+// Step over one AD structure starting at *pos. Stops at the end of the
+// significant part, on a zero length field, or on a truncated field.
+static bool next_field(const uint8_t **pos, const uint8_t *end, uint8_t *type,
+		       const uint8_t **data, uint8_t *data_len)
+{
+	const uint8_t *p = *pos;
+
+	if (end - p < 2 || p[0] == 0 || p[0] > end - p - 1) {
+		return false;
+	}
+
+	*type = p[1];
+	*data = &p[2];
+	*data_len = p[0] - 1;
+	*pos = p + 1 + p[0];
+
+	return true;
+}
+
+int adv_match(const struct net_buf_simple *ad, const struct adv_match_rule *rules, size_t count)
+{
+	const uint8_t *pos = ad->data;
+	const uint8_t *end = ad->data + ad->len;
+	const uint8_t *data;
+	uint8_t data_len;
+	uint8_t type;
+
+	while (next_field(&pos, end, &type, &data, &data_len)) {
+		for (size_t i = 0; i < count; i++) {
+			if (field_matches(&rules[i], type, data, data_len)) {
+				return i;
+			}
+		}
+	}
+
+	return -1;
+}
+
+uint8_t adv_match_name(const struct net_buf_simple *ad, const char **name)
+{
+	const uint8_t *pos = ad->data;
+	const uint8_t *end = ad->data + ad->len;
+	const uint8_t *data;
+	uint8_t data_len;
+	uint8_t type;
+
+	while (next_field(&pos, end, &type, &data, &data_len)) {
+		if (is_name(type)) {
+			*name = (const char *)data;
+			return data_len;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+/* adv_match.h - In-place advertising data matcher */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ADV_MATCH_H_
+#define ADV_MATCH_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+enum adv_match_type {
+	// Complete local name equal to data
+	ADV_MATCH_TYPE_NAME,
+	// Complete or shortened local name starting with data
+	ADV_MATCH_TYPE_NAME_PREFIX,
+	// 16-bit service UUID listed in the advertisement
+	ADV_MATCH_TYPE_UUID16,
+	// Manufacturer specific data starting with data (company ID first, little endian)
+	ADV_MATCH_TYPE_MANUFACTURER,
+};
+
+struct adv_match_rule {
+	enum adv_match_type type;
+	const uint8_t *data;
+	uint8_t len;
+	uint16_t uuid16;
+};
+
+#define ADV_MATCH_NAME(_name) \
+	{ .type = ADV_MATCH_TYPE_NAME, .data = (const uint8_t *)(_name), .len = sizeof(_name) - 1 }
+
+#define ADV_MATCH_NAME_PREFIX(_prefix) \
+	{ .type = ADV_MATCH_TYPE_NAME_PREFIX, .data = (const uint8_t *)(_prefix), \
+	  .len = sizeof(_prefix) - 1 }
+
+#define ADV_MATCH_UUID16(_uuid) { .type = ADV_MATCH_TYPE_UUID16, .uuid16 = (_uuid) }
+
+#define ADV_MATCH_MANUFACTURER(...) \
+	{ .type = ADV_MATCH_TYPE_MANUFACTURER, .data = (const uint8_t[]){ __VA_ARGS__ }, \
+	  .len = sizeof((const uint8_t[]){ __VA_ARGS__ }) }
+
+// Walk the AD structures once, in place, and return the index of the first
+// rule matched by any field, or -1. The buffer is not consumed.
+int adv_match(const struct net_buf_simple *ad, const struct adv_match_rule *rules, size_t count);
+
+// Point *name at the local name inside ad (not NUL terminated). Returns its
+// length, or 0 if the advertisement carries no name.
+uint8_t adv_match_name(const struct net_buf_simple *ad, const char **name);
+
+#endif /* ADV_MATCH_H_ */
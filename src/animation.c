@@ -0,0 +1,235 @@
+/* animation.c - Frame table driven colour animations */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/shell/shell.h>
+
+#include "color.h"
+#include "animation.h"
+
+LOG_MODULE_REGISTER(animation, CONFIG_APP_ANIM_LOG_LEVEL);
+
+#define FADE_STEPS  CONFIG_APP_ANIM_FADE_STEPS
+#define PULSE_STEPS CONFIG_APP_ANIM_PULSE_STEPS
+
+#define FADE_FRAME(_i, _from, _to) COLOR_LERP(_from, _to, _i, FADE_STEPS)
+
+// Interpolated at build time, nothing is computed per frame
+static const uint32_t fade_frames[] = {
+	LISTIFY(FADE_STEPS, FADE_FRAME, (,), COLOR_WHITE, COLOR_RED),
+	LISTIFY(FADE_STEPS, FADE_FRAME, (,), COLOR_RED, COLOR_GREEN),
+	LISTIFY(FADE_STEPS, FADE_FRAME, (,), COLOR_GREEN, COLOR_BLUE),
+	LISTIFY(FADE_STEPS, FADE_FRAME, (,), COLOR_BLUE, COLOR_WHITE),
+};
+
+// Up then down again, filled in for the colour given to animation_start()
+static uint32_t pulse_frames[2 * PULSE_STEPS];
+
+static const char *const effect_names[] = {
+	[ANIMATION_FADE] = "fade",
+	[ANIMATION_PULSE] = "pulse",
+	[ANIMATION_CHASE] = "chase",
+};
+
+static struct {
+	struct k_work_q *queue;
+	animation_output_t output;
+
+	// Start and stop come from the shell and the buttons, the frames run on queue
+	struct k_mutex ctl_lock;
+	enum animation_effect effect;
+	const uint32_t *frames;
+	size_t len;
+	atomic_t running;
+
+	// Ticks counted by the timer, the last one handed to output
+	atomic_t tick;
+	uint32_t last_tick;
+	uint32_t skipped;
+} anim;
+
+static void frame_work_handler(struct k_work *work);
+static K_WORK_DEFINE(frame_work, frame_work_handler);
+
+static void frame_timer_handler(struct k_timer *timer);
+static K_TIMER_DEFINE(frame_timer, frame_timer_handler, NULL);
+
+static void frame_timer_handler(struct k_timer *timer)
+{
+	// ISR context, the writes are issued from the work queue
+	atomic_inc(&anim.tick);
+	(void)k_work_submit_to_queue(anim.queue, &frame_work);
+}
+
+static void frame_work_handler(struct k_work *work)
+{
+	uint32_t tick = atomic_get(&anim.tick);
+
+	if (!atomic_get(&anim.running)) {
+		return;
+	}
+
+	// Frames the queue fell behind on are dropped, the effect keeps its pace
+	anim.skipped += tick - anim.last_tick - 1;
+	anim.last_tick = tick;
+
+	anim.output(tick);
+}
+
+static void pulse_build(uint32_t color)
+{
+	for (uint32_t i = 0; i < PULSE_STEPS; i++) {
+		// Squared ramp, perceived brightness rises about linearly
+		uint32_t level = (i * i * 256U) / (PULSE_STEPS * PULSE_STEPS);
+
+		pulse_frames[i] = COLOR_SCALE(color, level);
+		pulse_frames[ARRAY_SIZE(pulse_frames) - 1 - i] = pulse_frames[i];
+	}
+}
+
+void animation_init(struct k_work_q *queue, animation_output_t output)
+{
+	k_mutex_init(&anim.ctl_lock);
+	anim.queue = queue;
+	anim.output = output;
+}
+
+// With ctl_lock held. Once this returns no frame is being output.
+static void stop_locked(void)
+{
+	struct k_work_sync sync;
+
+	if (!atomic_cas(&anim.running, true, false)) {
+		return;
+	}
+
+	k_timer_stop(&frame_timer);
+	(void)k_work_cancel_sync(&frame_work, &sync);
+
+	LOG_INF("Animation %s stopped after %u frames, %u skipped", effect_names[anim.effect],
+		anim.last_tick, anim.skipped);
+}
+
+int animation_start(enum animation_effect effect, uint32_t color)
+{
+	if (effect >= ANIMATION_COUNT || !anim.output) {
+		return -EINVAL;
+	}
+
+	(void)k_mutex_lock(&anim.ctl_lock, K_FOREVER);
+
+	// The frame tables are only changed while no frame reads them
+	stop_locked();
+
+	if (effect == ANIMATION_PULSE) {
+		pulse_build(color);
+		anim.frames = pulse_frames;
+		anim.len = ARRAY_SIZE(pulse_frames);
+	} else {
+		anim.frames = fade_frames;
+		anim.len = ARRAY_SIZE(fade_frames);
+	}
+
+	anim.effect = effect;
+	anim.skipped = 0;
+	anim.last_tick = 0;
+	atomic_set(&anim.tick, 0);
+	atomic_set(&anim.running, true);
+
+	k_timer_start(&frame_timer, K_NO_WAIT, K_USEC(USEC_PER_SEC / CONFIG_APP_ANIM_FPS));
+
+	LOG_INF("Animation %s started, %u frames at %u fps", effect_names[effect],
+		(unsigned int)anim.len, CONFIG_APP_ANIM_FPS);
+
+	(void)k_mutex_unlock(&anim.ctl_lock);
+
+	return 0;
+}
+
+void animation_stop(void)
+{
+	if (!anim.output) {
+		return;
+	}
+
+	(void)k_mutex_lock(&anim.ctl_lock, K_FOREVER);
+	stop_locked();
+	(void)k_mutex_unlock(&anim.ctl_lock);
+}
+
+bool animation_running(void)
+{
+	return atomic_get(&anim.running);
+}
+
+uint32_t animation_frame(uint32_t tick, size_t slot, size_t count)
+{
+	size_t idx = tick % anim.len;
+
+	if (anim.effect == ANIMATION_CHASE && count) {
+		idx = (idx + (slot * anim.len) / count) % anim.len;
+	}
+
+	return anim.frames[idx];
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_anim_effect(const struct shell *sh, size_t argc, char **argv,
+			   enum animation_effect effect)
+{
+	uint32_t color = COLOR_WHITE;
+	int err;
+
+	if (argc > 1) {
+		color = strtoul(argv[1], NULL, 16);
+	}
+
+	err = animation_start(effect, color);
+	if (err) {
+		shell_error(sh, "Animation failed to start (err %d)", err);
+	}
+
+	return err;
+}
+
+static int cmd_anim_fade(const struct shell *sh, size_t argc, char **argv)
+{
+	return cmd_anim_effect(sh, argc, argv, ANIMATION_FADE);
+}
+
+static int cmd_anim_pulse(const struct shell *sh, size_t argc, char **argv)
+{
+	return cmd_anim_effect(sh, argc, argv, ANIMATION_PULSE);
+}
+
+static int cmd_anim_chase(const struct shell *sh, size_t argc, char **argv)
+{
+	return cmd_anim_effect(sh, argc, argv, ANIMATION_CHASE);
+}
+
+static int cmd_anim_stop(const struct shell *sh, size_t argc, char **argv)
+{
+	animation_stop();
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(anim_cmds,
+	SHELL_CMD(fade, NULL, "Cross-fade through the palette", cmd_anim_fade),
+	SHELL_CMD_ARG(pulse, NULL, "Breathe a colour in and out [wrgb, hex, white byte lowest]",
+		      cmd_anim_pulse, 1, 1),
+	SHELL_CMD(chase, NULL, "Cross-fade with the bulbs spread over it", cmd_anim_chase),
+	SHELL_CMD(stop, NULL, "Stop the running animation", cmd_anim_stop),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(anim, &anim_cmds, "Colour animations", NULL);
+#endif /* CONFIG_SHELL */
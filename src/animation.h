@@ -0,0 +1,40 @@
+/* animation.h - Frame table driven colour animations */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ANIMATION_H_
+#define ANIMATION_H_
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+
+enum animation_effect {
+	// Cross-fade through white, red, green and blue, every bulb in step
+	ANIMATION_FADE,
+	// Breathe one colour in and out
+	ANIMATION_PULSE,
+	// The fade, with the bulbs spread evenly over it
+	ANIMATION_CHASE,
+	ANIMATION_COUNT
+};
+
+// Called on the queue given to animation_init() once per frame. tick counts
+// frames since the start, ticks the queue could not keep up with are skipped.
+typedef void (*animation_output_t)(uint32_t tick);
+
+void animation_init(struct k_work_q *queue, animation_output_t output);
+
+// Start effect at CONFIG_APP_ANIM_FPS, replacing a running one. color is
+// the palette colour to pulse, the other effects ignore it.
+int animation_start(enum animation_effect effect, uint32_t color);
+
+void animation_stop(void);
+
+bool animation_running(void);
+
+// Palette colour of the slot-th of count bulbs at tick
+uint32_t animation_frame(uint32_t tick, size_t slot, size_t count);
+
+#endif /* ANIMATION_H_ */
@@ -0,0 +1,236 @@
+/* battery_log.c - Delta / run-length encoded battery level time series */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "battery_log.h"
+#include "host_cmd.h"
+
+BUILD_ASSERT(CONFIG_APP_BATTERY_LOG_BYTES >= 4, "room for two absolute records");
+// A series is exported in a single event frame
+BUILD_ASSERT(BATTERY_LOG_EXPORT_MAX <= HOST_CMD_EVT_DATA_MAX, "series exceeds an event frame");
+// The fleet index goes out in the one byte bulb field of the event frame
+BUILD_ASSERT(CONFIG_APP_FLEET_MAX <= UINT8_MAX + 1, "fleet index exceeds a byte");
+
+struct series {
+	uint8_t buf[CONFIG_APP_BATTERY_LOG_BYTES];
+	uint8_t len;
+	// Level of the last sample in buf, when len is not 0
+	uint8_t level;
+	// The last record is a run and may grow
+	bool run_open;
+	bool active;
+	// Sample number of the first record
+	uint32_t first_seq;
+	bt_addr_le_t addr;
+	// Written from the BT RX thread, sampled from the queue
+	atomic_t latest;
+};
+
+static struct series series[CONFIG_APP_FLEET_MAX];
+
+// Number of the next sample
+static uint32_t seq;
+
+// Retry interval while the host link is still sending earlier frames
+#define EXPORT_RETRY_MS 20
+
+static struct k_work_q *log_queue;
+static battery_log_export_t exporter;
+
+static void sample_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(sample_work, sample_handler);
+
+static void export_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(export_work, export_work_handler);
+
+static int8_t record_delta(uint8_t rec)
+{
+	// Sign extend the low six bits
+	return (int8_t)(rec << 2) >> 2;
+}
+
+// Drop the oldest samples until need more bytes fit. The samples dropped
+// collapse into the last of them, rewritten as an absolute record so the
+// deltas after it still decode.
+static void compact(struct series *s, size_t need)
+{
+	uint32_t samples = 0;
+	uint8_t level = 0;
+	size_t p = 0;
+
+	while (p < s->len) {
+		uint8_t rec = s->buf[p];
+
+		if ((rec & BATTERY_LOG_ABSOLUTE) == BATTERY_LOG_ABSOLUTE) {
+			level = s->buf[p + 1];
+			samples++;
+			p += 2;
+		} else if (rec & BATTERY_LOG_DELTA) {
+			level += record_delta(rec);
+			samples++;
+			p++;
+		} else {
+			samples += rec + 1U;
+			p++;
+		}
+
+		if (s->len - p + 2 + need <= sizeof(s->buf)) {
+			break;
+		}
+	}
+
+	if (p == s->len) {
+		s->run_open = false;
+	}
+
+	memmove(&s->buf[2], &s->buf[p], s->len - p);
+	s->buf[0] = BATTERY_LOG_ABSOLUTE;
+	s->buf[1] = level;
+	s->len = s->len - p + 2;
+	s->first_seq += samples - 1;
+}
+
+static void append(struct series *s, uint8_t level)
+{
+	int delta = (int)level - (int)s->level;
+	uint8_t rec[2];
+	size_t n;
+
+	if (s->len && level == s->level) {
+		if (s->run_open && s->buf[s->len - 1] < BATTERY_LOG_RUN_MAX) {
+			s->buf[s->len - 1]++;
+			return;
+		}
+		rec[0] = 0;
+		n = 1;
+	} else if (s->len && level != BATTERY_LOG_UNKNOWN && s->level != BATTERY_LOG_UNKNOWN &&
+		   delta >= -32 && delta <= 31) {
+		rec[0] = BATTERY_LOG_DELTA | (delta & 0x3F);
+		n = 1;
+	} else {
+		rec[0] = BATTERY_LOG_ABSOLUTE;
+		rec[1] = level;
+		n = 2;
+	}
+
+	// Compaction keeps the last level, so rec still applies afterwards
+	if (s->len + n > sizeof(s->buf)) {
+		compact(s, n);
+	}
+
+	memcpy(&s->buf[s->len], rec, n);
+	s->len += n;
+	s->level = level;
+	s->run_open = !(rec[0] & BATTERY_LOG_DELTA);
+}
+
+static void sample_handler(struct k_work *work)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(series); i++) {
+		struct series *s = &series[i];
+
+		// Also without a link, until what it holds has been exported
+		if (s->active || s->len) {
+			append(s, (uint8_t)atomic_get(&s->latest));
+		}
+	}
+
+	seq++;
+
+	(void)k_work_schedule_for_queue(log_queue, &sample_work,
+				       K_SECONDS(CONFIG_APP_BATTERY_LOG_PERIOD_S));
+}
+
+// Copy the series of s in export format to buf, returns its length
+static size_t encode(const struct series *s, uint8_t *buf)
+{
+	buf[0] = s->addr.type;
+	memcpy(&buf[1], s->addr.a.val, sizeof(s->addr.a.val));
+	sys_put_le32(s->first_seq, &buf[7]);
+	sys_put_le16(CONFIG_APP_BATTERY_LOG_PERIOD_S, &buf[11]);
+	memcpy(&buf[BATTERY_LOG_HDR_LEN], s->buf, s->len);
+
+	return BATTERY_LOG_HDR_LEN + s->len;
+}
+
+static void consume(struct series *s)
+{
+	s->len = 0;
+	s->run_open = false;
+	s->first_seq = seq;
+}
+
+// All series in one batch, one frame per bulb instead of one per notification
+static void export_work_handler(struct k_work *work)
+{
+	static size_t index;
+	uint8_t buf[BATTERY_LOG_EXPORT_MAX];
+	int err;
+
+	for (; index < ARRAY_SIZE(series); index++) {
+		struct series *s = &series[index];
+
+		if (!s->len) {
+			continue;
+		}
+
+		err = exporter(index, buf, encode(s, buf));
+		if (err == -ENOMEM) {
+			// Carry on with this series once the host link caught up
+			(void)k_work_schedule_for_queue(log_queue, &export_work,
+						       K_MSEC(EXPORT_RETRY_MS));
+			return;
+		}
+
+		consume(s);
+	}
+
+	index = 0;
+	(void)k_work_schedule_for_queue(log_queue, &export_work,
+				       K_SECONDS(CONFIG_APP_BATTERY_LOG_EXPORT_S));
+}
+
+void battery_log_init(struct k_work_q *queue, battery_log_export_t export)
+{
+	log_queue = queue;
+	exporter = export;
+
+	(void)k_work_schedule_for_queue(queue, &sample_work,
+				       K_SECONDS(CONFIG_APP_BATTERY_LOG_PERIOD_S));
+	(void)k_work_schedule_for_queue(queue, &export_work,
+				       K_SECONDS(CONFIG_APP_BATTERY_LOG_EXPORT_S));
+}
+
+void battery_log_start(uint8_t index, const bt_addr_le_t *addr)
+{
+	struct series *s = &series[index];
+
+	// Samples since the last export are kept, the gap logged as unknown
+	if (!s->len) {
+		consume(s);
+	}
+	bt_addr_le_copy(&s->addr, addr);
+	atomic_set(&s->latest, BATTERY_LOG_UNKNOWN);
+	s->active = true;
+}
+
+void battery_log_stop(uint8_t index)
+{
+	struct series *s = &series[index];
+
+	atomic_set(&s->latest, BATTERY_LOG_UNKNOWN);
+	s->active = false;
+}
+
+void battery_log_update(uint8_t index, uint8_t level)
+{
+	atomic_set(&series[index].latest, level);
+}
@@ -0,0 +1,60 @@
+/* battery_log.h - Delta / run-length encoded battery level time series */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BATTERY_LOG_H_
+#define BATTERY_LOG_H_
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/addr.h>
+
+// Level of a sample taken while the bulb had no link or never reported one
+#define BATTERY_LOG_UNKNOWN 0xFF
+
+// One series per fleet member, so a bulb keeps its series across links and a
+// slot taken over by another bulb never mixes their levels. Every
+// CONFIG_APP_BATTERY_LOG_PERIOD_S the latest level of each logged bulb is
+// appended to its series as one sample. Records, one or two bytes each:
+//
+//   0b0nnnnnnn           the previous level n + 1 more times
+//   0b10dddddd           previous level + d (signed, -32 to 31)
+//   0b11000000 level     level, or BATTERY_LOG_UNKNOWN
+//
+// A series always starts with an absolute record. Once it is full the
+// oldest samples are dropped, so a bulb never takes more than
+// CONFIG_APP_BATTERY_LOG_BYTES. Without a link a series with samples not
+// exported yet carries on with BATTERY_LOG_UNKNOWN, keeping it contiguous.
+#define BATTERY_LOG_RUN_MAX 0x7F
+#define BATTERY_LOG_DELTA 0x80
+#define BATTERY_LOG_ABSOLUTE 0xC0
+
+// Exported series: address type and the 6 address bytes (little endian) of
+// the bulb, u32 sample number of the first record, u16 sample period in
+// seconds, then the records. Sample n was taken n periods after boot.
+#define BATTERY_LOG_HDR_LEN 13
+#define BATTERY_LOG_EXPORT_MAX (BATTERY_LOG_HDR_LEN + CONFIG_APP_BATTERY_LOG_BYTES)
+
+// Hand the exported series of fleet member index to the host. Return
+// -ENOMEM to have it retried shortly, any other error drops it.
+typedef int (*battery_log_export_t)(uint8_t index, const uint8_t *data, size_t len);
+
+// Sample on queue, the one battery_log_start() and battery_log_stop() have
+// to be called from, and export through export every
+// CONFIG_APP_BATTERY_LOG_EXPORT_S
+void battery_log_init(struct k_work_q *queue, battery_log_export_t export);
+
+// Log fleet member index at addr. Carries on with its series while that still
+// holds samples not exported, starts a new one otherwise.
+void battery_log_start(uint8_t index, const bt_addr_le_t *addr);
+
+// The link is gone: levels are unknown until the next battery_log_start(),
+// what was logged is still exported
+void battery_log_stop(uint8_t index);
+
+// Latest level reported by fleet member index, may be called from any context
+void battery_log_update(uint8_t index, uint8_t level);
+
+#endif /* BATTERY_LOG_H_ */
@@ -0,0 +1,613 @@
+/* bench.c - GATT write/read/notify throughput and latency benchmark */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "bench.h"
+
+LOG_MODULE_REGISTER(bench, CONFIG_APP_BENCH_LOG_LEVEL);
+
+// Payload of the benchmark writes: white, so the bulb does not flicker
+#define BENCH_WRITE_VALUE 0x000000FF
+
+// Retry delay when the host is out of TX buffers and nothing is in flight
+#define BENCH_RETRY_MS 1
+
+typedef enum {
+	BENCH_IDLE,
+	BENCH_START,
+	BENCH_SETUP,
+	BENCH_WRITE,
+	BENCH_READ,
+} bench_phase_t;
+
+typedef struct {
+	uint16_t interval;
+	uint8_t phy;
+} bench_setting_t;
+
+// Connection interval (1.25 ms units) x PHY combinations of the sweep
+static const bench_setting_t sweep[] = {
+	{ 6, BT_GAP_LE_PHY_1M },
+	{ 6, BT_GAP_LE_PHY_2M },
+	{ 12, BT_GAP_LE_PHY_1M },
+	{ 12, BT_GAP_LE_PHY_2M },
+	{ 24, BT_GAP_LE_PHY_1M },
+	{ 24, BT_GAP_LE_PHY_2M },
+	{ 48, BT_GAP_LE_PHY_1M },
+	{ 48, BT_GAP_LE_PHY_2M },
+};
+
+typedef struct {
+	uint32_t ops;
+	uint32_t bytes;
+	uint32_t errors;
+	uint32_t duration_ms;
+	// Latency percentiles in us
+	uint32_t p50;
+	uint32_t p90;
+	uint32_t p99;
+	uint32_t max;
+
+} bench_result_t;
+
+static struct {
+	struct bt_conn *conn;
+	uint16_t write_handle;
+	uint16_t read_handle;
+	bool peer_2m;
+
+	// Set by the first bench_start(), so later links are left alone
+	bool started;
+	bench_phase_t phase;
+	size_t setting;
+	struct bt_gatt_read_params read_params;
+
+	struct k_spinlock lock;
+	int64_t phase_start;
+	uint32_t ops;
+	uint32_t bytes;
+	uint32_t errors;
+	// Counted from the notification thread
+	atomic_t notifications;
+
+	// Writes complete in order, so their submit times form a FIFO
+	uint32_t submit_cycles[CONFIG_APP_BENCH_WRITE_DEPTH];
+	uint8_t head;
+	uint8_t tail;
+	uint8_t in_flight;
+	uint32_t read_cycles;
+
+	uint32_t samples[CONFIG_APP_BENCH_SAMPLES];
+	uint32_t sample_count;
+
+	bench_result_t write_result;
+
+	// Best of all settings, checked against the baselines at the end
+	uint32_t best_write_ops;
+	uint32_t best_write_p99;
+	uint32_t best_read_ops;
+
+	// Slowest bring-up of any bulb so far, and the fleet's, 0 until known.
+	// Reported from bulb_workq, under the lock.
+	uint32_t bringups;
+	uint32_t worst_connect_ms;
+	uint32_t worst_discovery_ms;
+	uint32_t fleet_ready_ms;
+} bench;
+
+static void phase_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(phase_work, phase_work_handler);
+
+static void retry_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(retry_work, retry_work_handler);
+
+static void read_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(read_work, read_work_handler);
+
+static void sample_add(uint32_t start_cycles)
+{
+	// The first CONFIG_APP_BENCH_SAMPLES of each phase make the percentiles
+	if (bench.sample_count < ARRAY_SIZE(bench.samples)) {
+		bench.samples[bench.sample_count++] = k_cyc_to_us_floor32(k_cycle_get_32() - start_cycles);
+	}
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint32_t percentile(uint32_t pct)
+{
+	return bench.samples[(bench.sample_count - 1) * pct / 100];
+}
+
+// The phase is also checked from the GATT callbacks, under the lock
+static bench_phase_t phase_get(void)
+{
+	bench_phase_t phase;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+	phase = bench.phase;
+	k_spin_unlock(&bench.lock, key);
+
+	return phase;
+}
+
+static void phase_set(bench_phase_t phase)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+	bench.phase = phase;
+	k_spin_unlock(&bench.lock, key);
+}
+
+static void phase_begin(bench_phase_t phase)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+	bench.phase = phase;
+	bench.phase_start = k_uptime_get();
+	bench.ops = 0;
+	bench.bytes = 0;
+	bench.errors = 0;
+	bench.head = 0;
+	bench.tail = 0;
+	bench.in_flight = 0;
+	bench.sample_count = 0;
+	k_spin_unlock(&bench.lock, key);
+}
+
+static void phase_end(bench_result_t *res)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+	// Late completions are ignored from here on
+	bench.phase = BENCH_SETUP;
+	res->ops = bench.ops;
+	res->bytes = bench.bytes;
+	res->errors = bench.errors;
+	k_spin_unlock(&bench.lock, key);
+
+	res->duration_ms = MAX((uint32_t)(k_uptime_get() - bench.phase_start), 1U);
+
+	if (!bench.sample_count) {
+		res->p50 = res->p90 = res->p99 = res->max = 0;
+		return;
+	}
+
+	qsort(bench.samples, bench.sample_count, sizeof(bench.samples[0]), cmp_u32);
+
+	res->p50 = percentile(50);
+	res->p90 = percentile(90);
+	res->p99 = percentile(99);
+	res->max = bench.samples[bench.sample_count - 1];
+}
+
+static void pump(void);
+
+static void write_done(struct bt_conn *conn, void *user_data)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+
+	if (bench.phase != BENCH_WRITE || conn != bench.conn || !bench.in_flight) {
+		k_spin_unlock(&bench.lock, key);
+		return;
+	}
+
+	sample_add(bench.submit_cycles[bench.tail]);
+	bench.tail = (bench.tail + 1) % ARRAY_SIZE(bench.submit_cycles);
+	bench.in_flight--;
+	bench.ops++;
+	bench.bytes += sizeof(uint32_t);
+
+	k_spin_unlock(&bench.lock, key);
+
+	pump();
+}
+
+// Keep CONFIG_APP_BENCH_WRITE_DEPTH writes in flight until the phase ends
+static void pump(void)
+{
+	uint32_t value = BENCH_WRITE_VALUE;
+	k_spinlock_key_t key;
+	uint8_t slot;
+	int err;
+
+	key = k_spin_lock(&bench.lock);
+
+	while (bench.phase == BENCH_WRITE && bench.in_flight < ARRAY_SIZE(bench.submit_cycles)) {
+		slot = bench.head;
+		bench.submit_cycles[slot] = k_cycle_get_32();
+		bench.head = (slot + 1) % ARRAY_SIZE(bench.submit_cycles);
+		bench.in_flight++;
+
+		k_spin_unlock(&bench.lock, key);
+
+		err = bt_gatt_write_without_response_cb(bench.conn, bench.write_handle, &value,
+							sizeof(value), false, write_done, NULL);
+
+		key = k_spin_lock(&bench.lock);
+
+		if (!err) {
+			continue;
+		}
+
+		// Not sent, give the FIFO slot back
+		bench.head = slot;
+		bench.in_flight--;
+
+		if (err == -ENOMEM) {
+			if (!bench.in_flight) {
+				k_work_schedule(&retry_work, K_MSEC(BENCH_RETRY_MS));
+			}
+		} else {
+			bench.errors++;
+		}
+		break;
+	}
+
+	k_spin_unlock(&bench.lock, key);
+}
+
+static void retry_work_handler(struct k_work *work)
+{
+	pump();
+}
+
+static uint8_t read_done(struct bt_conn *conn, uint8_t err,
+			 struct bt_gatt_read_params *params,
+			 const void *data, uint16_t length)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+
+	if (bench.phase == BENCH_READ) {
+		if (err || !data) {
+			bench.errors++;
+		} else {
+			sample_add(bench.read_cycles);
+			bench.ops++;
+			bench.bytes += length;
+		}
+
+		// The next read is issued outside of this callback, the params are still in use
+		k_work_schedule(&read_work, K_NO_WAIT);
+	}
+
+	k_spin_unlock(&bench.lock, key);
+
+	return BT_GATT_ITER_STOP;
+}
+
+static void read_work_handler(struct k_work *work)
+{
+	k_spinlock_key_t key;
+	int err;
+
+	bench.read_params.func = read_done;
+	bench.read_params.handle_count = 1;
+	bench.read_params.single.handle = bench.read_handle;
+	bench.read_params.single.offset = 0;
+
+	key = k_spin_lock(&bench.lock);
+	if (bench.phase != BENCH_READ) {
+		k_spin_unlock(&bench.lock, key);
+		return;
+	}
+	bench.read_cycles = k_cycle_get_32();
+	k_spin_unlock(&bench.lock, key);
+
+	err = bt_gatt_read(bench.conn, &bench.read_params);
+	if (err) {
+		key = k_spin_lock(&bench.lock);
+		bench.errors++;
+		k_spin_unlock(&bench.lock, key);
+		k_work_schedule(&read_work, K_MSEC(BENCH_RETRY_MS));
+	}
+}
+
+static void apply_setting(const bench_setting_t *setting)
+{
+	const struct bt_le_conn_param param =
+		BT_LE_CONN_PARAM_INIT(setting->interval, setting->interval, 0, 400);
+	const struct bt_conn_le_phy_param phy = {
+		.options = BT_CONN_LE_PHY_OPT_NONE,
+		.pref_tx_phy = setting->phy,
+		.pref_rx_phy = setting->phy,
+	};
+	int err;
+
+	err = bt_conn_le_param_update(bench.conn, &param);
+	if (err && err != -EALREADY) {
+		LOG_WRN("Connection parameter update failed (err %d)", err);
+	}
+
+	err = bt_conn_le_phy_update(bench.conn, &phy);
+	if (err && err != -EALREADY) {
+		LOG_WRN("PHY update failed (err %d)", err);
+	}
+}
+
+static bool next_setting(void)
+{
+	if (!IS_ENABLED(CONFIG_APP_BENCH_SWEEP)) {
+		return bench.setting++ == 0;
+	}
+
+	for (; bench.setting < ARRAY_SIZE(sweep); bench.setting++) {
+		if (sweep[bench.setting].phy == BT_GAP_LE_PHY_2M && !bench.peer_2m) {
+			continue;
+		}
+
+		apply_setting(&sweep[bench.setting++]);
+		return true;
+	}
+
+	return false;
+}
+
+static uint32_t ops_per_s(const bench_result_t *res)
+{
+	return res->duration_ms ? res->ops * 1000U / res->duration_ms : 0;
+}
+
+static void log_result(const char *name, const bench_result_t *res)
+{
+	LOG_INF("  %s: %u ops/s, %u B/s, latency p50 %u.%03u p90 %u.%03u p99 %u.%03u "
+		"max %u.%03u ms, %u errors", name,
+		ops_per_s(res), res->duration_ms ? res->bytes * 1000U / res->duration_ms : 0,
+		res->p50 / 1000U, res->p50 % 1000U, res->p90 / 1000U, res->p90 % 1000U,
+		res->p99 / 1000U, res->p99 % 1000U, res->max / 1000U, res->max % 1000U,
+		res->errors);
+}
+
+static void report(const bench_result_t *read_result, uint32_t duration_ms)
+{
+	struct bt_conn_info info;
+	uint32_t interval_us = 0;
+	uint8_t tx_phy = 0;
+	uint8_t rx_phy = 0;
+
+	// What the peer actually accepted, not what was asked for
+	if (!bt_conn_get_info(bench.conn, &info)) {
+		interval_us = info.le.interval * 1250U;
+		tx_phy = info.le.phy->tx_phy;
+		rx_phy = info.le.phy->rx_phy;
+	}
+
+	LOG_INF("Benchmark at interval %u.%02u ms, PHY tx %u rx %u, MTU %u",
+		interval_us / 1000U, (interval_us % 1000U) / 10U, tx_phy, rx_phy,
+		bt_gatt_get_mtu(bench.conn));
+	log_result("write", &bench.write_result);
+	log_result("read", read_result);
+	LOG_INF("  notify: %u received in %u ms", (uint32_t)atomic_get(&bench.notifications),
+		duration_ms);
+
+	bench.best_write_ops = MAX(bench.best_write_ops, ops_per_s(&bench.write_result));
+	bench.best_read_ops = MAX(bench.best_read_ops, ops_per_s(read_result));
+	if (bench.write_result.p99 &&
+	    (!bench.best_write_p99 || bench.write_result.p99 < bench.best_write_p99)) {
+		bench.best_write_p99 = bench.write_result.p99;
+	}
+}
+
+// One verdict line for the test harness, a baseline of 0 is not checked
+static void check_baselines(void)
+{
+	uint32_t connect_ms, discovery_ms, fleet_ms, bringups;
+	k_spinlock_key_t key;
+	bool pass = true;
+
+	key = k_spin_lock(&bench.lock);
+	bringups = bench.bringups;
+	connect_ms = bench.worst_connect_ms;
+	discovery_ms = bench.worst_discovery_ms;
+	fleet_ms = bench.fleet_ready_ms;
+	k_spin_unlock(&bench.lock, key);
+
+	LOG_INF("Bring-up of %u bulb(s): connect %u ms, discovery %u ms at worst, fleet ready "
+		"after %u ms", bringups, connect_ms, discovery_ms, fleet_ms);
+
+	if (CONFIG_APP_BENCH_BASELINE_CONNECT_MS && connect_ms > CONFIG_APP_BENCH_BASELINE_CONNECT_MS) {
+		LOG_ERR("Scan to connect in %u ms, baseline %u ms", connect_ms,
+			CONFIG_APP_BENCH_BASELINE_CONNECT_MS);
+		pass = false;
+	}
+
+	if (CONFIG_APP_BENCH_BASELINE_DISCOVERY_MS &&
+	    discovery_ms > CONFIG_APP_BENCH_BASELINE_DISCOVERY_MS) {
+		LOG_ERR("Discovery in %u ms, baseline %u ms", discovery_ms,
+			CONFIG_APP_BENCH_BASELINE_DISCOVERY_MS);
+		pass = false;
+	}
+
+	// Not up by now counts as too slow
+	if (CONFIG_APP_BENCH_BASELINE_FLEET_READY_MS &&
+	    (!fleet_ms || fleet_ms > CONFIG_APP_BENCH_BASELINE_FLEET_READY_MS)) {
+		LOG_ERR("%u bulbs ready after %u ms, baseline %u ms", CONFIG_APP_FLEET_SIZE,
+			fleet_ms ? fleet_ms : k_uptime_get_32(),
+			CONFIG_APP_BENCH_BASELINE_FLEET_READY_MS);
+		pass = false;
+	}
+
+	if (bench.best_write_ops < CONFIG_APP_BENCH_BASELINE_WRITE_OPS) {
+		LOG_ERR("Writes at %u ops/s, baseline %u ops/s", bench.best_write_ops,
+			CONFIG_APP_BENCH_BASELINE_WRITE_OPS);
+		pass = false;
+	}
+
+	if (CONFIG_APP_BENCH_BASELINE_WRITE_P99_US &&
+	    bench.best_write_p99 > CONFIG_APP_BENCH_BASELINE_WRITE_P99_US) {
+		LOG_ERR("Write latency p99 %u us, baseline %u us", bench.best_write_p99,
+			CONFIG_APP_BENCH_BASELINE_WRITE_P99_US);
+		pass = false;
+	}
+
+	if (bench.best_read_ops < CONFIG_APP_BENCH_BASELINE_READ_OPS) {
+		LOG_ERR("Reads at %u ops/s, baseline %u ops/s", bench.best_read_ops,
+			CONFIG_APP_BENCH_BASELINE_READ_OPS);
+		pass = false;
+	}
+
+	LOG_INF("Benchmark %s", pass ? "PASS" : "FAIL");
+}
+
+static void bench_stop(void)
+{
+	struct k_work_sync sync;
+
+	phase_set(BENCH_IDLE);
+	(void)k_work_cancel_delayable_sync(&retry_work, &sync);
+	(void)k_work_cancel_delayable_sync(&read_work, &sync);
+
+	if (bench.conn) {
+		bt_conn_unref(bench.conn);
+		bench.conn = NULL;
+	}
+}
+
+static void phase_work_handler(struct k_work *work)
+{
+	bench_result_t read_result;
+	static int64_t setting_start;
+
+	switch (phase_get()) {
+	case BENCH_IDLE:
+		return;
+
+	case BENCH_START:
+		if (!next_setting()) {
+			bench_stop();
+			return;
+		}
+		phase_set(BENCH_SETUP);
+		k_work_schedule(&phase_work, K_MSEC(CONFIG_APP_BENCH_SETTLE_MS));
+		return;
+
+	case BENCH_SETUP:
+		// Settled on the new setting, start with the writes
+		setting_start = k_uptime_get();
+		atomic_clear(&bench.notifications);
+		phase_begin(BENCH_WRITE);
+		pump();
+		break;
+
+	case BENCH_WRITE:
+		phase_end(&bench.write_result);
+		phase_begin(BENCH_READ);
+		k_work_schedule(&read_work, K_NO_WAIT);
+		break;
+
+	case BENCH_READ:
+		phase_end(&read_result);
+		report(&read_result, (uint32_t)(k_uptime_get() - setting_start));
+
+		if (!next_setting()) {
+			LOG_INF("Benchmark done");
+			check_baselines();
+			bench_stop();
+			return;
+		}
+
+		k_work_schedule(&phase_work, K_MSEC(CONFIG_APP_BENCH_SETTLE_MS));
+		return;
+	}
+
+	k_work_schedule(&phase_work, K_MSEC(CONFIG_APP_BENCH_DURATION_MS));
+}
+
+int bench_start(struct bt_conn *conn, uint16_t write_handle, uint16_t read_handle)
+{
+	struct bt_conn_remote_info remote_info;
+
+	if (bench.started) {
+		return -EALREADY;
+	}
+
+	bench.started = true;
+	bench.conn = bt_conn_ref(conn);
+	bench.write_handle = write_handle;
+	bench.read_handle = read_handle;
+	bench.peer_2m = !bt_conn_get_remote_info(conn, &remote_info) &&
+			BT_FEAT_LE_PHY_2M(remote_info.le.features);
+	bench.setting = 0;
+	bench.best_write_ops = 0;
+	bench.best_write_p99 = 0;
+	bench.best_read_ops = 0;
+	phase_set(BENCH_START);
+
+	LOG_INF("Benchmark starts in %u ms", CONFIG_APP_BENCH_START_DELAY_MS);
+
+	// Let link tuning finish first, it would fight over the connection parameters
+	k_work_schedule(&phase_work, K_MSEC(CONFIG_APP_BENCH_START_DELAY_MS));
+
+	return 0;
+}
+
+void bench_notify(struct bt_conn *conn, uint16_t length)
+{
+	if (conn == bench.conn) {
+		(void)atomic_inc(&bench.notifications);
+	}
+}
+
+void bench_bringup(uint32_t connect_ms, uint32_t discovery_ms)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+	bench.bringups++;
+	bench.worst_connect_ms = MAX(bench.worst_connect_ms, connect_ms);
+	bench.worst_discovery_ms = MAX(bench.worst_discovery_ms, discovery_ms);
+	k_spin_unlock(&bench.lock, key);
+}
+
+void bench_fleet_ready(uint32_t ms)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&bench.lock);
+	bench.fleet_ready_ms = ms;
+	k_spin_unlock(&bench.lock, key);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	struct k_work_sync sync;
+
+	if (conn != bench.conn) {
+		return;
+	}
+
+	LOG_WRN("Link lost, benchmark aborted");
+	(void)k_work_cancel_delayable_sync(&phase_work, &sync);
+	bench_stop();
+}
+
+BT_CONN_CB_DEFINE(bench_callbacks) = {
+	.disconnected = disconnected,
+};
@@ -0,0 +1,32 @@
+/* bench.h - GATT write/read/notify throughput and latency benchmark */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/conn.h>
+
+// Benchmark an established link, after CONFIG_APP_BENCH_START_DELAY_MS:
+// back-to-back Write Without Response to write_handle, then sequential reads
+// of read_handle, each for CONFIG_APP_BENCH_DURATION_MS. With
+// CONFIG_APP_BENCH_SWEEP this is repeated for every connection interval and
+// PHY of the sweep table. Results are logged per setting. Only the first
+// link is benchmarked, even once that is done or lost: -EALREADY otherwise.
+int bench_start(struct bt_conn *conn, uint16_t write_handle, uint16_t read_handle);
+
+// Count a notification received on conn
+void bench_notify(struct bt_conn *conn, uint16_t length);
+
+// A bulb found by the scan got ready: connect_ms from initiating the
+// connection to the link coming up (0 when not measured), discovery_ms from
+// there to ready. The slowest of each is checked against its baseline.
+void bench_bringup(uint32_t connect_ms, uint32_t discovery_ms);
+
+// All CONFIG_APP_FLEET_SIZE bulbs got ready, ms after boot
+void bench_fleet_ready(uint32_t ms);
+
+#endif /* BENCH_H_ */
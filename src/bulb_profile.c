@@ -0,0 +1,90 @@
+/* bulb_profile.c - Per-model bulb profiles, fixed at build time */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/uuid.h>
+
+#include "adv_match.h"
+#include "bulb_profile.h"
+
+// One line per model: X(name, advertising rule, colour UUID, colour encoding,
+// battery level notifications). The rule and the profile tables below are both
+// expanded from this list, which keeps their indices aligned.
+#if defined(CONFIG_APP_PROFILE_PLAYBULB_CANDLE)
+#define PROFILE_PLAYBULB_CANDLE(X) \
+	X("Playbulb Candle", ADV_MATCH_NAME_PREFIX("PLAYBULB CANDLE II"), 0xFFFC, BULB_COLOR_WRGB, true)
+#else
+#define PROFILE_PLAYBULB_CANDLE(X)
+#endif
+
+#if defined(CONFIG_APP_PROFILE_PLAYBULB_SPHERE)
+#define PROFILE_PLAYBULB_SPHERE(X) \
+	X("Playbulb Sphere", ADV_MATCH_NAME_PREFIX("PLAYBULB sphere"), 0xFFFC, BULB_COLOR_WRGB, true)
+#else
+#define PROFILE_PLAYBULB_SPHERE(X)
+#endif
+
+#define BULB_PROFILES(X) \
+	PROFILE_PLAYBULB_CANDLE(X) \
+	PROFILE_PLAYBULB_SPHERE(X)
+
+#define PROFILE_RULE(_name, _rule, _color_uuid, _encoding, _battery_ccc) _rule,
+
+#define PROFILE_ENTRY(_name, _rule, _color_uuid, _encoding, _battery_ccc) \
+	{ \
+		.name = _name, \
+		.color_encoding = _encoding, \
+		.chrcs = { \
+			[BULB_CHRC_COLOR] = { .uuid = BT_UUID_DECLARE_16(_color_uuid) }, \
+			[BULB_CHRC_BATTERY_LEVEL] = { .uuid = BT_UUID_BAS_BATTERY_LEVEL, \
+						      .need_ccc = _battery_ccc }, \
+		}, \
+		.value_lens = { \
+			[BULB_CHRC_COLOR] = sizeof(uint32_t), \
+			[BULB_CHRC_BATTERY_LEVEL] = sizeof(uint8_t), \
+		}, \
+	},
+
+static const struct adv_match_rule rules[] = {
+	BULB_PROFILES(PROFILE_RULE)
+};
+
+static const struct bulb_profile profiles[] = {
+	BULB_PROFILES(PROFILE_ENTRY)
+};
+
+BUILD_ASSERT(ARRAY_SIZE(profiles) > 0, "no bulb profile enabled");
+BUILD_ASSERT(ARRAY_SIZE(profiles) <= UINT8_MAX, "profile ids are 8 bits wide");
+
+int bulb_profile_match(const struct net_buf_simple *ad)
+{
+	// Rule i belongs to profile i
+	return adv_match(ad, rules, ARRAY_SIZE(rules));
+}
+
+const struct bulb_profile *bulb_profile_get(uint8_t id)
+{
+	return id < ARRAY_SIZE(profiles) ? &profiles[id] : &profiles[0];
+}
+
+uint8_t bulb_profile_id(const struct bulb_profile *profile)
+{
+	return profile - profiles;
+}
+
+uint32_t bulb_profile_color(const struct bulb_profile *profile, uint32_t wrgb)
+{
+	switch (profile->color_encoding) {
+	case BULB_COLOR_RGBW:
+		// White moves from the first to the last byte on air
+		return (wrgb >> 8) | (wrgb << 24);
+
+	case BULB_COLOR_WRGB:
+	default:
+		return wrgb;
+	}
+}
@@ -0,0 +1,51 @@
+/* bulb_profile.h - Per-model bulb profiles, fixed at build time */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BULB_PROFILE_H_
+#define BULB_PROFILE_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+#include "gatt_discovery.h"
+
+// Characteristics looked up in the single discovery sweep
+enum {
+	BULB_CHRC_COLOR,
+	BULB_CHRC_BATTERY_LEVEL,
+	BULB_CHRC_COUNT
+};
+
+// Wire layout of the 4 byte colour value, first byte first
+enum bulb_color_encoding {
+	BULB_COLOR_WRGB,
+	BULB_COLOR_RGBW,
+};
+
+struct bulb_profile {
+	const char *name;
+	enum bulb_color_encoding color_encoding;
+	// Indexed by BULB_CHRC_*, need_ccc on the battery level enables its notifications
+	struct gatt_discovery_chrc chrcs[BULB_CHRC_COUNT];
+	// Length of each value, indexed by BULB_CHRC_* too
+	uint8_t value_lens[BULB_CHRC_COUNT];
+};
+
+// Match the advertisement against every compiled in profile in a single pass.
+// Returns the profile id, or -1.
+int bulb_profile_match(const struct net_buf_simple *ad);
+
+// Profile for an id returned by bulb_profile_match(), the first profile for
+// unknown ids (e.g. a bulb learned by an older build)
+const struct bulb_profile *bulb_profile_get(uint8_t id);
+
+uint8_t bulb_profile_id(const struct bulb_profile *profile);
+
+// Convert a palette colour (white, red, green, blue from the lowest byte up)
+// to the value written to the profile's colour characteristic
+uint32_t bulb_profile_color(const struct bulb_profile *profile, uint32_t wrgb);
+
+#endif /* BULB_PROFILE_H_ */
@@ -0,0 +1,147 @@
+/* central_stats.c - Per-link runtime counters and tracing markers */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/bluetooth/hci.h>
+
+#include "central_stats.h"
+#include "gatt_sched.h"
+
+// Updated from the BT RX thread, bulb_workq and the notification thread
+typedef struct {
+	atomic_t notifications;
+	atomic_t reads;
+	atomic_t read_round_trips;
+	atomic_t read_errors;
+	atomic_t discovery_ops;
+	atomic_t writes_rejected;
+	atomic_t disconnects;
+	atomic_t last_reason;
+
+} link_stats_t;
+
+// Indexed by connection slot
+static link_stats_t links[CONFIG_BT_MAX_CONN];
+
+static atomic_t scan_reports;
+static atomic_t scan_matches;
+
+static central_stats_writes_t get_writes;
+
+void central_stats_init(central_stats_writes_t writes)
+{
+	get_writes = writes;
+}
+
+void central_stats_scan_report(void)
+{
+	(void)atomic_inc(&scan_reports);
+}
+
+void central_stats_scan_match(void)
+{
+	(void)atomic_inc(&scan_matches);
+}
+
+void central_stats_notify(int slot)
+{
+	(void)atomic_inc(&links[slot].notifications);
+}
+
+void central_stats_read(int slot, uint16_t round_trips, int err)
+{
+	(void)atomic_inc(&links[slot].reads);
+	(void)atomic_add(&links[slot].read_round_trips, round_trips);
+	if (err) {
+		(void)atomic_inc(&links[slot].read_errors);
+	}
+}
+
+void central_stats_discovery_ops(int slot, uint16_t ops)
+{
+	(void)atomic_add(&links[slot].discovery_ops, ops);
+}
+
+void central_stats_write_rejected(int slot)
+{
+	(void)atomic_inc(&links[slot].writes_rejected);
+}
+
+void central_stats_disconnected(int slot, uint8_t reason)
+{
+	(void)atomic_inc(&links[slot].disconnects);
+	atomic_set(&links[slot].last_reason, reason);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_central_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct color_queue_stats writes;
+	struct gatt_sched_stats sched;
+	uint32_t reports = atomic_get(&scan_reports);
+	uint32_t matches = atomic_get(&scan_matches);
+
+	shell_print(sh, "scan: %u reports, %u matched, %u filtered", reports, matches,
+		    reports - matches);
+
+	gatt_sched_get_stats(&sched);
+	shell_print(sh, "att: %u issued, %u deferred, %u failed, %u in flight (peak %u)",
+		    sched.issued, sched.deferred, sched.failed, sched.in_flight,
+		    sched.peak_in_flight);
+
+	for (size_t slot = 0; slot < ARRAY_SIZE(links); slot++) {
+		const link_stats_t *l = &links[slot];
+		bool up = get_writes && get_writes(slot, &writes);
+		uint8_t reason = atomic_get(&l->last_reason);
+
+		if (!up && !atomic_get(&l->discovery_ops) && !atomic_get(&l->disconnects)) {
+			continue;
+		}
+
+		shell_print(sh, "Slot %u%s", (unsigned int)slot, up ? "" : " (no link)");
+		if (up) {
+			shell_print(sh, "  writes: %u sent, %u completed, %u failed, %u retried, "
+				    "%u rejected", writes.sent, writes.completed, writes.failed,
+				    writes.no_mem, (uint32_t)atomic_get(&l->writes_rejected));
+		}
+		shell_print(sh, "  notifications: %u", (uint32_t)atomic_get(&l->notifications));
+		shell_print(sh, "  reads: %u in %u round trip(s), %u incomplete",
+			    (uint32_t)atomic_get(&l->reads),
+			    (uint32_t)atomic_get(&l->read_round_trips),
+			    (uint32_t)atomic_get(&l->read_errors));
+		shell_print(sh, "  discovery: %u ATT procedure(s)",
+			    (uint32_t)atomic_get(&l->discovery_ops));
+		shell_print(sh, "  disconnects: %u, last reason 0x%02x %s",
+			    (uint32_t)atomic_get(&l->disconnects), reason,
+			    atomic_get(&l->disconnects) ? bt_hci_err_to_str(reason) : "");
+	}
+
+	return 0;
+}
+
+static int cmd_central_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	for (size_t slot = 0; slot < ARRAY_SIZE(links); slot++) {
+		(void)memset(&links[slot], 0, sizeof(links[slot]));
+	}
+
+	atomic_clear(&scan_reports);
+	atomic_clear(&scan_matches);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(central_cmds,
+	SHELL_CMD(stats, NULL, "Scan, ATT and per link counters", cmd_central_stats),
+	SHELL_CMD(reset, NULL, "Clear the counters", cmd_central_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(central, &central_cmds, "Central runtime statistics", NULL);
+#endif /* CONFIG_SHELL */
@@ -0,0 +1,88 @@
+/* central_stats.h - Per-link runtime counters and tracing markers */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef CENTRAL_STATS_H_
+#define CENTRAL_STATS_H_
+
+#include <zephyr/types.h>
+
+#if defined(CONFIG_TRACING)
+#include <zephyr/tracing/tracing.h>
+#endif
+
+#include "color_queue.h"
+
+// Colour write counters of the link on slot, false if the slot has no ready link
+typedef bool (*central_stats_writes_t)(int slot, struct color_queue_stats *stats);
+
+#if defined(CONFIG_APP_CENTRAL_STATS)
+
+// writes is asked for the write counters when they are printed
+void central_stats_init(central_stats_writes_t writes);
+
+// A scan report reached the central, and one of them was matched as a bulb
+void central_stats_scan_report(void);
+void central_stats_scan_match(void);
+
+// The slot counters are kept across links, so the last disconnect reason
+// is still there once the bulb is gone
+void central_stats_notify(int slot);
+void central_stats_read(int slot, uint16_t round_trips, int err);
+void central_stats_discovery_ops(int slot, uint16_t ops);
+void central_stats_write_rejected(int slot);
+void central_stats_disconnected(int slot, uint8_t reason);
+
+#else
+
+static inline void central_stats_init(central_stats_writes_t writes) {}
+static inline void central_stats_scan_report(void) {}
+static inline void central_stats_scan_match(void) {}
+static inline void central_stats_notify(int slot) {}
+static inline void central_stats_read(int slot, uint16_t round_trips, int err) {}
+static inline void central_stats_discovery_ops(int slot, uint16_t ops) {}
+static inline void central_stats_write_rejected(int slot) {}
+static inline void central_stats_disconnected(int slot, uint8_t reason) {}
+
+#endif /* CONFIG_APP_CENTRAL_STATS */
+
+// Named tracing events around the BT callbacks, for CTF or SystemView based
+// tools to show how long each one runs. CENTRAL_TRACE() goes last among the
+// declarations of a callback: it records the entry, and the exit once the
+// function returns. arg0 is the connection index (0 when there is none),
+// arg1 tells entry from exit.
+#define CENTRAL_TRACE_ENTER 0
+#define CENTRAL_TRACE_EXIT 1
+
+#if defined(CONFIG_TRACING)
+
+struct central_trace_scope {
+	const char *callback;
+	uint32_t link;
+};
+
+static inline struct central_trace_scope central_trace_enter(const char *callback, uint32_t link)
+{
+	sys_trace_named_event(callback, link, CENTRAL_TRACE_ENTER);
+
+	return (struct central_trace_scope){ .callback = callback, .link = link };
+}
+
+static inline void central_trace_exit(struct central_trace_scope *scope)
+{
+	sys_trace_named_event(scope->callback, scope->link, CENTRAL_TRACE_EXIT);
+}
+
+#define CENTRAL_TRACE(callback, link) \
+	struct central_trace_scope central_trace_scope \
+		__attribute__((cleanup(central_trace_exit))) = central_trace_enter(callback, link)
+
+#else
+
+#define CENTRAL_TRACE(callback, link) (void)0
+
+#endif /* CONFIG_TRACING */
+
+#endif /* CENTRAL_STATS_H_ */
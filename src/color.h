@@ -0,0 +1,49 @@
+/* color.h - Colour value layout and build time colour arithmetic */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef COLOR_H_
+#define COLOR_H_
+
+#include <zephyr/types.h>
+
+// Palette colours keep white, red, green and blue from the lowest byte up.
+// bulb_profile_color() converts them to what a bulb expects on air.
+#define COLOR_W_SHIFT 0
+#define COLOR_R_SHIFT 8
+#define COLOR_G_SHIFT 16
+#define COLOR_B_SHIFT 24
+
+#define COLOR_WRGB(_w, _r, _g, _b) \
+	(((uint32_t)(_w) << COLOR_W_SHIFT) | ((uint32_t)(_r) << COLOR_R_SHIFT) | \
+	 ((uint32_t)(_g) << COLOR_G_SHIFT) | ((uint32_t)(_b) << COLOR_B_SHIFT))
+
+#define COLOR_WHITE COLOR_WRGB(0xFF, 0, 0, 0)
+#define COLOR_RED   COLOR_WRGB(0, 0xFF, 0, 0)
+#define COLOR_GREEN COLOR_WRGB(0, 0, 0xFF, 0)
+#define COLOR_BLUE  COLOR_WRGB(0, 0, 0, 0xFF)
+
+#define COLOR_CH(_c, _shift) (((uint32_t)(_c) >> (_shift)) & 0xFFU)
+
+// Channel _shift of step _i of _n from _a to _b. Integer only, so it folds
+// into a constant when used in a static initializer.
+#define COLOR_LERP_CH(_a, _b, _shift, _i, _n) \
+	((uint32_t)((int32_t)COLOR_CH(_a, _shift) + \
+		    (((int32_t)COLOR_CH(_b, _shift) - (int32_t)COLOR_CH(_a, _shift)) * (int32_t)(_i)) / \
+		    (int32_t)(_n)) << (_shift))
+
+#define COLOR_LERP(_a, _b, _i, _n) \
+	(COLOR_LERP_CH(_a, _b, COLOR_W_SHIFT, _i, _n) | COLOR_LERP_CH(_a, _b, COLOR_R_SHIFT, _i, _n) | \
+	 COLOR_LERP_CH(_a, _b, COLOR_G_SHIFT, _i, _n) | COLOR_LERP_CH(_a, _b, COLOR_B_SHIFT, _i, _n))
+
+// Every channel of _c scaled by _level / 256
+#define COLOR_SCALE_CH(_c, _shift, _level) \
+	(((COLOR_CH(_c, _shift) * (uint32_t)(_level)) >> 8) << (_shift))
+
+#define COLOR_SCALE(_c, _level) \
+	(COLOR_SCALE_CH(_c, COLOR_W_SHIFT, _level) | COLOR_SCALE_CH(_c, COLOR_R_SHIFT, _level) | \
+	 COLOR_SCALE_CH(_c, COLOR_G_SHIFT, _level) | COLOR_SCALE_CH(_c, COLOR_B_SHIFT, _level))
+
+#endif /* COLOR_H_ */
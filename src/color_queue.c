@@ -0,0 +1,265 @@
+/* color_queue.c - Coalescing, flow controlled colour write queue */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "color_queue.h"
+
+LOG_MODULE_REGISTER(color_queue, CONFIG_APP_COLOR_QUEUE_LOG_LEVEL);
+
+static int pump(struct color_queue *q);
+
+static void write_complete(struct bt_conn *conn, void *user_data)
+{
+	struct color_queue *q = user_data;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&q->lock);
+
+	if (q->conn != conn) {
+		// Completion of a write issued before the queue was reset
+		k_spin_unlock(&q->lock, key);
+		return;
+	}
+
+	if (q->in_flight) {
+		q->in_flight--;
+		q->done_gen = q->gen_fifo[q->gen_tail];
+		q->done_cycles = k_cycle_get_32();
+		q->gen_tail = (q->gen_tail + 1) % ARRAY_SIZE(q->gen_fifo);
+	}
+
+	q->stats.completed++;
+	if (q->stats.window_completed++ == 0) {
+		q->stats.window_start = k_uptime_get();
+	}
+
+	k_spin_unlock(&q->lock, key);
+
+	gatt_sched_done(&q->op);
+
+	if (q->on_complete) {
+		q->on_complete(q);
+	}
+
+	// A TX slot just freed up, send whatever is waiting
+	(void)pump(q);
+}
+
+static void retry_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct color_queue *q = CONTAINER_OF(dwork, struct color_queue, retry_work);
+
+	(void)pump(q);
+}
+
+// Hand the pending frame to the host. Called by the scheduler once the
+// write may go out.
+static int issue(struct gatt_sched_op *op)
+{
+	struct color_queue *q = CONTAINER_OF(op, struct color_queue, op);
+	k_spinlock_key_t key;
+	struct bt_conn *conn;
+	uint32_t value;
+	uint32_t gen;
+	int err;
+
+	key = k_spin_lock(&q->lock);
+
+	// Reset, or the frame went out with an earlier op
+	if (!q->conn || !q->pending || q->in_flight >= CONFIG_APP_COLOR_QUEUE_DEPTH) {
+		k_spin_unlock(&q->lock, key);
+		return -ENODATA;
+	}
+
+	conn = q->conn;
+	value = q->pending_value;
+	gen = q->pending_gen;
+	q->pending = false;
+	q->gen_fifo[(q->gen_tail + q->in_flight) % ARRAY_SIZE(q->gen_fifo)] = gen;
+	q->in_flight++;
+
+	k_spin_unlock(&q->lock, key);
+
+	err = bt_gatt_write_without_response_cb(conn, q->handle, &value, sizeof(value),
+						false, write_complete, q);
+
+	key = k_spin_lock(&q->lock);
+
+	if (!err) {
+		q->stats.sent++;
+		k_spin_unlock(&q->lock, key);
+		return 0;
+	}
+
+	q->in_flight--;
+
+	if (err == -ENOMEM) {
+		// Keep the frame unless a newer one was queued in the meantime
+		if (!q->pending) {
+			q->pending = true;
+			q->pending_value = value;
+			q->pending_gen = gen;
+		}
+		q->stats.no_mem++;
+
+		// Buffers held by other links produce no completion for us, so poll
+		if (!q->in_flight) {
+			k_work_schedule(&q->retry_work, K_MSEC(CONFIG_APP_COLOR_QUEUE_RETRY_MS));
+		}
+	} else {
+		q->stats.failed++;
+		LOG_ERR("Color write failed (err %d)", err);
+	}
+
+	k_spin_unlock(&q->lock, key);
+
+	return err;
+}
+
+// Queue a write with the scheduler while a frame waits and a TX slot is free
+static int pump(struct color_queue *q)
+{
+	k_spinlock_key_t key;
+	struct bt_conn *conn;
+	bool ready;
+	int err;
+
+	key = k_spin_lock(&q->lock);
+	conn = q->conn;
+	ready = conn && q->pending && q->in_flight < CONFIG_APP_COLOR_QUEUE_DEPTH;
+	k_spin_unlock(&q->lock, key);
+
+	if (!ready) {
+		return 0;
+	}
+
+	// Already queued, it picks up the newest frame when issued
+	err = gatt_sched_submit(&q->op, conn);
+
+	return err == -EALREADY ? 0 : err;
+}
+
+void color_queue_init(struct color_queue *q, struct bt_conn *conn, uint16_t handle,
+		      color_queue_complete_t on_complete)
+{
+	gatt_sched_cancel(&q->op);
+	(void)memset(q, 0, sizeof(*q));
+
+	q->conn = conn;
+	q->handle = handle;
+	q->on_complete = on_complete;
+	gatt_sched_op_init(&q->op, GATT_SCHED_PRIO_WRITE, issue);
+	k_work_init_delayable(&q->retry_work, retry_work_handler);
+}
+
+void color_queue_reset(struct color_queue *q)
+{
+	struct k_work_sync sync;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&q->lock);
+	q->conn = NULL;
+	q->pending = false;
+	q->in_flight = 0;
+	k_spin_unlock(&q->lock, key);
+
+	gatt_sched_cancel(&q->op);
+	(void)k_work_cancel_delayable_sync(&q->retry_work, &sync);
+}
+
+// gen NULL keeps the generation of the frame queued last
+static int submit(struct color_queue *q, uint32_t color, const uint32_t *gen)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&q->lock);
+
+	if (!q->conn) {
+		k_spin_unlock(&q->lock, key);
+		return -ENOTCONN;
+	}
+
+	q->stats.submitted++;
+	if (q->pending) {
+		q->stats.coalesced++;
+	}
+
+	q->pending = true;
+	q->pending_value = color;
+	if (gen) {
+		q->pending_gen = *gen;
+	}
+
+	k_spin_unlock(&q->lock, key);
+
+	// The caller reports a rejected frame, a failed write is logged by issue()
+	return pump(q);
+}
+
+int color_queue_submit(struct color_queue *q, uint32_t color)
+{
+	// Untagged frames carry on the current generation
+	return submit(q, color, NULL);
+}
+
+int color_queue_submit_gen(struct color_queue *q, uint32_t color, uint32_t gen)
+{
+	return submit(q, color, &gen);
+}
+
+bool color_queue_last_done(struct color_queue *q, uint32_t *gen, uint32_t *cycles)
+{
+	k_spinlock_key_t key;
+	bool up;
+
+	key = k_spin_lock(&q->lock);
+	up = q->conn != NULL;
+	*gen = q->done_gen;
+	*cycles = q->done_cycles;
+	k_spin_unlock(&q->lock, key);
+
+	return up;
+}
+
+void color_queue_get_stats(struct color_queue *q, struct color_queue_stats *stats)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&q->lock);
+	*stats = q->stats;
+	k_spin_unlock(&q->lock, key);
+}
+
+uint32_t color_queue_writes_per_event_x100(const struct color_queue_stats *stats,
+					   uint16_t interval)
+{
+	int64_t elapsed_ms = k_uptime_get() - stats->window_start;
+
+	if (!stats->window_completed || elapsed_ms <= 0) {
+		return 0;
+	}
+
+	// events = elapsed / (interval * 1.25 ms), so x100 is completed * interval * 125 / elapsed
+	return (uint32_t)(((uint64_t)stats->window_completed * interval * 125U) /
+			  (uint64_t)elapsed_ms);
+}
+
+void color_queue_window_reset(struct color_queue *q)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&q->lock);
+	q->stats.window_completed = 0;
+	q->stats.window_start = 0;
+	k_spin_unlock(&q->lock, key);
+}
@@ -0,0 +1,93 @@
+/* color_queue.h - Coalescing, flow controlled colour write queue */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef COLOR_QUEUE_H_
+#define COLOR_QUEUE_H_
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "gatt_sched.h"
+
+struct color_queue_stats {
+	// Frames handed to color_queue_submit()
+	uint32_t submitted;
+	// Frames overwritten by a newer one before they were sent
+	uint32_t coalesced;
+	// Writes accepted by the host
+	uint32_t sent;
+	// Writes reported done by the completion callback
+	uint32_t completed;
+	// Host TX buffers exhausted, write retried later
+	uint32_t no_mem;
+	// Writes dropped for any other error
+	uint32_t failed;
+	// Uptime (ms) of the first completion in the current measurement window
+	int64_t window_start;
+	uint32_t window_completed;
+};
+
+struct color_queue;
+
+// Called from the BT context after each completed write
+typedef void (*color_queue_complete_t)(struct color_queue *q);
+
+struct color_queue {
+	struct bt_conn *conn;
+	uint16_t handle;
+	color_queue_complete_t on_complete;
+
+	struct k_spinlock lock;
+	// Only the most recent colour matters, so one pending slot is enough
+	bool pending;
+	uint32_t pending_value;
+	uint8_t in_flight;
+
+	// Generation of the pending frame and of the frames in flight (oldest at
+	// gen_tail), so a caller can tell when a given submission went out
+	uint32_t pending_gen;
+	uint32_t gen_fifo[CONFIG_APP_COLOR_QUEUE_DEPTH];
+	uint8_t gen_tail;
+	// Generation of the last completed write and k_cycle_get_32() at that time
+	uint32_t done_gen;
+	uint32_t done_cycles;
+
+	// Each write goes out through the scheduler, ahead of setup and reads
+	struct gatt_sched_op op;
+	struct k_work_delayable retry_work;
+	struct color_queue_stats stats;
+};
+
+void color_queue_init(struct color_queue *q, struct bt_conn *conn, uint16_t handle,
+		      color_queue_complete_t on_complete);
+
+// Drop anything pending and stop using the connection
+void color_queue_reset(struct color_queue *q);
+
+// Queue a colour frame. Sent immediately when a TX slot is free, otherwise it
+// replaces any frame still waiting and goes out on the next completion.
+int color_queue_submit(struct color_queue *q, uint32_t color);
+
+// As color_queue_submit(), tagging the frame with generation gen. done_gen
+// reaches gen once it (or a later frame that replaced it) completed.
+int color_queue_submit_gen(struct color_queue *q, uint32_t color, uint32_t gen);
+
+// Generation and k_cycle_get_32() of the last completed write, read
+// together. Returns false once the queue was reset.
+bool color_queue_last_done(struct color_queue *q, uint32_t *gen, uint32_t *cycles);
+
+// Consistent copy of the counters, they are updated from the BT context
+void color_queue_get_stats(struct color_queue *q, struct color_queue_stats *stats);
+
+// Completed writes per connection event (x100) since the window of stats
+// started. interval is the connection interval in units of 1.25 ms.
+uint32_t color_queue_writes_per_event_x100(const struct color_queue_stats *stats,
+					   uint16_t interval);
+
+void color_queue_window_reset(struct color_queue *q);
+
+#endif /* COLOR_QUEUE_H_ */
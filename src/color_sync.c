@@ -0,0 +1,173 @@
+/* color_sync.c - Colour broadcast to every bulb with skew measurement */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "color_sync.h"
+
+LOG_MODULE_REGISTER(color_sync, CONFIG_APP_COLOR_SYNC_LOG_LEVEL);
+
+static struct {
+	struct k_spinlock lock;
+	bool active;
+	uint32_t gen;
+	uint32_t start_cycles;
+	struct color_queue *qs[CONFIG_BT_MAX_CONN];
+	size_t count;
+	struct color_sync_stats stats;
+} sync;
+
+static void timeout_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(timeout_work, timeout_handler);
+
+static bool gen_reached(uint32_t done_gen, uint32_t gen)
+{
+	return (int32_t)(done_gen - gen) >= 0;
+}
+
+static void timeout_handler(struct k_work *work)
+{
+	size_t confirmed = 0;
+	k_spinlock_key_t key;
+	uint32_t done_gen;
+	uint32_t cycles;
+	size_t count;
+
+	key = k_spin_lock(&sync.lock);
+
+	if (!sync.active) {
+		k_spin_unlock(&sync.lock, key);
+		return;
+	}
+
+	for (size_t i = 0; i < sync.count; i++) {
+		(void)color_queue_last_done(sync.qs[i], &done_gen, &cycles);
+		confirmed += gen_reached(done_gen, sync.gen);
+	}
+	count = sync.count;
+
+	sync.active = false;
+	sync.stats.incomplete++;
+
+	k_spin_unlock(&sync.lock, key);
+
+	LOG_WRN("Colour broadcast confirmed by %u of %u bulbs only",
+		(unsigned int)confirmed, (unsigned int)count);
+}
+
+int color_sync_broadcast(struct color_queue *const *qs, const uint32_t *colors,
+			 size_t count, bool *accepted)
+{
+	k_spinlock_key_t key;
+	uint32_t gen;
+	int queued = 0;
+	bool ok;
+
+	count = MIN(count, ARRAY_SIZE(sync.qs));
+
+	key = k_spin_lock(&sync.lock);
+
+	if (sync.active) {
+		sync.stats.incomplete++;
+	}
+
+	gen = ++sync.gen;
+	memcpy(sync.qs, qs, count * sizeof(qs[0]));
+	sync.count = count;
+	sync.active = count > 0;
+	sync.start_cycles = k_cycle_get_32();
+	sync.stats.broadcasts++;
+
+	k_spin_unlock(&sync.lock, key);
+
+	// Hand every write to the host before anything else gets to run, so they all
+	// go out in the next connection event of their link
+	k_sched_lock();
+	for (size_t i = 0; i < count; i++) {
+		ok = !color_queue_submit_gen(qs[i], colors[i], gen);
+		queued += ok;
+		if (accepted) {
+			accepted[i] = ok;
+		}
+	}
+	k_sched_unlock();
+
+	k_work_reschedule(&timeout_work, K_MSEC(CONFIG_APP_COLOR_SYNC_TIMEOUT_MS));
+
+	return queued;
+}
+
+void color_sync_complete(struct color_queue *q)
+{
+	uint32_t first = UINT32_MAX;
+	uint32_t last = 0;
+	k_spinlock_key_t key;
+	uint32_t skew_us;
+	uint32_t latency_us;
+	uint32_t done_gen;
+	uint32_t cycles;
+	size_t count;
+
+	key = k_spin_lock(&sync.lock);
+
+	if (!sync.active) {
+		k_spin_unlock(&sync.lock, key);
+		return;
+	}
+
+	for (size_t i = 0; i < sync.count; i++) {
+		uint32_t t;
+
+		// Links that dropped meanwhile do not hold the others up. Taken under
+		// each queue's own lock, the other links complete concurrently.
+		if (!color_queue_last_done(sync.qs[i], &done_gen, &cycles)) {
+			continue;
+		}
+
+		if (!gen_reached(done_gen, sync.gen)) {
+			k_spin_unlock(&sync.lock, key);
+			return;
+		}
+
+		t = cycles - sync.start_cycles;
+		first = MIN(first, t);
+		last = MAX(last, t);
+	}
+
+	if (first > last) {
+		// Every link dropped, nothing to measure
+		first = last;
+	}
+
+	skew_us = k_cyc_to_us_floor32(last - first);
+	latency_us = k_cyc_to_us_floor32(last);
+	count = sync.count;
+
+	sync.active = false;
+	sync.stats.completed++;
+	sync.stats.last_skew_us = skew_us;
+	sync.stats.max_skew_us = MAX(sync.stats.max_skew_us, skew_us);
+	sync.stats.last_latency_us = latency_us;
+
+	k_spin_unlock(&sync.lock, key);
+
+	(void)k_work_cancel_delayable(&timeout_work);
+
+	LOG_INF("Colour on %u bulbs within %u.%03u ms of each other, %u.%03u ms after submit",
+		(unsigned int)count, skew_us / 1000U, skew_us % 1000U, latency_us / 1000U, latency_us % 1000U);
+}
+
+void color_sync_get_stats(struct color_sync_stats *stats)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&sync.lock);
+	*stats = sync.stats;
+	k_spin_unlock(&sync.lock, key);
+}
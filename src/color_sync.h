@@ -0,0 +1,40 @@
+/* color_sync.h - Colour broadcast to every bulb with skew measurement */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef COLOR_SYNC_H_
+#define COLOR_SYNC_H_
+
+#include <zephyr/types.h>
+
+#include "color_queue.h"
+
+struct color_sync_stats {
+	uint32_t broadcasts;
+	// Broadcasts confirmed on every link
+	uint32_t completed;
+	// Superseded by a newer broadcast or timed out before that
+	uint32_t incomplete;
+	// Spread between the first and the last write completion, in us
+	uint32_t last_skew_us;
+	uint32_t max_skew_us;
+	// Submission to the last completion, in us
+	uint32_t last_latency_us;
+};
+
+// Queue colors[i] on qs[i] for every i < count, back to back. The achieved
+// skew is logged and kept in the statistics once every link confirmed the
+// write, or the broadcast is given up after CONFIG_APP_COLOR_SYNC_TIMEOUT_MS.
+// accepted[i], if not NULL, tells whether qs[i] took its colour. Returns the
+// number of links the colour was queued on.
+int color_sync_broadcast(struct color_queue *const *qs, const uint32_t *colors,
+			 size_t count, bool *accepted);
+
+// color_queue completion hook, pass it to color_queue_init()
+void color_sync_complete(struct color_queue *q);
+
+void color_sync_get_stats(struct color_sync_stats *stats);
+
+#endif /* COLOR_SYNC_H_ */
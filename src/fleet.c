@@ -0,0 +1,168 @@
+/* fleet.c - Registry of bulb addresses we have connected to before */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "fleet.h"
+
+LOG_MODULE_REGISTER(fleet, CONFIG_APP_FLEET_LOG_LEVEL);
+
+typedef struct {
+	bt_addr_le_t addr;
+	uint8_t profile;
+} fleet_member_t;
+
+// Written from bulb_workq, looked up from the BT RX thread as well. Members are
+// only ever appended: once member_count covers an entry its address is never
+// rewritten, so a count read under the lock makes the addresses below it safe
+// to read without, e.g. around calls into the host.
+static fleet_member_t members[CONFIG_APP_FLEET_MAX];
+static size_t member_count;
+static struct k_spinlock lock;
+
+static int find_locked(const bt_addr_le_t *addr)
+{
+	for (size_t i = 0; i < member_count; i++) {
+		if (bt_addr_le_eq(&members[i].addr, addr)) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+int fleet_find(const bt_addr_le_t *addr)
+{
+	k_spinlock_key_t key;
+	int idx;
+
+	key = k_spin_lock(&lock);
+	idx = find_locked(addr);
+	k_spin_unlock(&lock, key);
+
+	return idx;
+}
+
+int fleet_add(const bt_addr_le_t *addr, uint8_t profile)
+{
+	k_spinlock_key_t key;
+	int idx;
+
+	key = k_spin_lock(&lock);
+
+	idx = find_locked(addr);
+	if (idx >= 0) {
+		members[idx].profile = profile;
+	} else if (member_count >= ARRAY_SIZE(members)) {
+		idx = -ENOMEM;
+	} else {
+		// Published by the count, after the entry is complete
+		bt_addr_le_copy(&members[member_count].addr, addr);
+		members[member_count].profile = profile;
+		idx = member_count++;
+	}
+
+	k_spin_unlock(&lock, key);
+
+	return idx;
+}
+
+uint8_t fleet_profile(const bt_addr_le_t *addr)
+{
+	k_spinlock_key_t key;
+	uint8_t profile;
+	int idx;
+
+	key = k_spin_lock(&lock);
+	idx = find_locked(addr);
+	profile = idx >= 0 ? members[idx].profile : 0;
+	k_spin_unlock(&lock, key);
+
+	return profile;
+}
+
+size_t fleet_count(void)
+{
+	k_spinlock_key_t key;
+	size_t count;
+
+	key = k_spin_lock(&lock);
+	count = member_count;
+	k_spin_unlock(&lock, key);
+
+	return count;
+}
+
+static bool member_connected(const bt_addr_le_t *addr)
+{
+	struct bt_conn *conn;
+
+	conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+	if (!conn) {
+		return false;
+	}
+
+	bt_conn_unref(conn);
+
+	return true;
+}
+
+size_t fleet_disconnected_count(void)
+{
+	size_t n = fleet_count();
+	size_t count = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (!member_connected(&members[i].addr)) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+bool fleet_complete(void)
+{
+	return CONFIG_APP_FLEET_SIZE > 0 && fleet_count() >= CONFIG_APP_FLEET_SIZE;
+}
+
+int fleet_accept_list_sync(void)
+{
+#if defined(CONFIG_BT_FILTER_ACCEPT_LIST)
+	size_t n = fleet_count();
+	int added = 0;
+	int err;
+
+	err = bt_le_filter_accept_list_clear();
+	if (err) {
+		return err;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (member_connected(&members[i].addr)) {
+			continue;
+		}
+
+		err = bt_le_filter_accept_list_add(&members[i].addr);
+		if (err) {
+			// Controller list full, the remaining bulbs wait for a free entry
+			LOG_ERR("Filter accept list add failed (err %d)", err);
+			break;
+		}
+
+		added++;
+	}
+
+	return added;
+#else
+	return -ENOTSUP;
+#endif
+}
@@ -0,0 +1,36 @@
+/* fleet.h - Registry of bulb addresses we have connected to before */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FLEET_H_
+#define FLEET_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/addr.h>
+
+// Remember addr as a fleet member of the given bulb_profile id. Returns its
+// index, or -ENOMEM when full.
+int fleet_add(const bt_addr_le_t *addr, uint8_t profile);
+
+// Index of addr in the fleet, or -ENOENT
+int fleet_find(const bt_addr_le_t *addr);
+
+// bulb_profile id of a member, 0 if addr is unknown
+uint8_t fleet_profile(const bt_addr_le_t *addr);
+
+size_t fleet_count(void);
+
+// Number of known bulbs without an active connection
+size_t fleet_disconnected_count(void);
+
+// True once CONFIG_APP_FLEET_SIZE distinct bulbs have been learned
+bool fleet_complete(void);
+
+// Replace the controller's filter accept list with every known bulb that is
+// not currently connected. Scanning and initiating must be stopped.
+// Returns the number of addresses added or a negative error.
+int fleet_accept_list_sync(void);
+
+#endif /* FLEET_H_ */
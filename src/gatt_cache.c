@@ -0,0 +1,215 @@
+/* gatt_cache.c - Per-peer GATT handle cache */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "gatt_cache.h"
+
+LOG_MODULE_REGISTER(gatt_cache, CONFIG_APP_GATT_CACHE_LOG_LEVEL);
+
+#define GATT_CACHE_SETTINGS_ROOT "gcache"
+
+BUILD_ASSERT(CONFIG_APP_GATT_CACHE_SIZE <= 32, "dirty mask is 32 bits wide");
+
+typedef struct {
+	bool valid;
+	uint32_t last_used;
+	struct gatt_cache_entry entry;
+
+} gatt_cache_slot_t;
+
+// Taken by the BT RX callbacks and the persist work
+static struct k_spinlock cache_lock;
+static gatt_cache_slot_t cache[CONFIG_APP_GATT_CACHE_SIZE];
+static uint32_t use_counter;
+
+// Slots that still have to be written to / deleted from settings
+static atomic_t dirty_mask;
+
+static void persist_work_handler(struct k_work *work);
+static K_WORK_DEFINE(persist_work, persist_work_handler);
+
+static gatt_cache_slot_t *slot_find(const bt_addr_le_t *addr)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(cache); i++) {
+		if (cache[i].valid && bt_addr_le_eq(&cache[i].entry.addr, addr)) {
+			return &cache[i];
+		}
+	}
+
+	return NULL;
+}
+
+static gatt_cache_slot_t *slot_alloc(void)
+{
+	gatt_cache_slot_t *oldest = &cache[0];
+
+	for (size_t i = 0; i < ARRAY_SIZE(cache); i++) {
+		if (!cache[i].valid) {
+			return &cache[i];
+		}
+
+		if (cache[i].last_used < oldest->last_used) {
+			oldest = &cache[i];
+		}
+	}
+
+	return oldest;
+}
+
+static void mark_dirty(const gatt_cache_slot_t *slot)
+{
+	if (!IS_ENABLED(CONFIG_APP_GATT_CACHE_PERSIST)) {
+		return;
+	}
+
+	atomic_or(&dirty_mask, BIT(slot - cache));
+	k_work_submit(&persist_work);
+}
+
+static void persist_work_handler(struct k_work *work)
+{
+	char key[sizeof(GATT_CACHE_SETTINGS_ROOT) + 4];
+	struct gatt_cache_entry entry;
+	k_spinlock_key_t lock;
+	uint32_t dirty;
+	bool valid;
+	int err;
+
+	if (!IS_ENABLED(CONFIG_APP_GATT_CACHE_PERSIST)) {
+		return;
+	}
+
+	// Flash writes are done here rather than from the BT RX callbacks
+	dirty = atomic_clear(&dirty_mask);
+
+	for (size_t i = 0; i < ARRAY_SIZE(cache); i++) {
+		if (!(dirty & BIT(i))) {
+			continue;
+		}
+
+		snprintk(key, sizeof(key), GATT_CACHE_SETTINGS_ROOT "/%u", (unsigned int)i);
+
+		// Flash writes can take long, save a copy rather than hold the lock
+		lock = k_spin_lock(&cache_lock);
+		valid = cache[i].valid;
+		entry = cache[i].entry;
+		k_spin_unlock(&cache_lock, lock);
+
+		if (valid) {
+			err = settings_save_one(key, &entry, sizeof(entry));
+		} else {
+			err = settings_delete(key);
+		}
+
+		if (err) {
+			LOG_ERR("Failed to persist slot %u (err %d)", (unsigned int)i, err);
+		}
+	}
+}
+
+#if defined(CONFIG_APP_GATT_CACHE_PERSIST)
+static int gatt_cache_settings_set(const char *key, size_t len,
+				   settings_read_cb read_cb, void *cb_arg)
+{
+	unsigned long idx;
+	ssize_t rc;
+
+	idx = strtoul(key, NULL, 10);
+	if (idx >= ARRAY_SIZE(cache) || len != sizeof(cache[idx].entry)) {
+		// Stale entry from a build with a different cache layout
+		return 0;
+	}
+
+	rc = read_cb(cb_arg, &cache[idx].entry, sizeof(cache[idx].entry));
+	if (rc < 0) {
+		return rc;
+	}
+
+	cache[idx].valid = true;
+	cache[idx].last_used = 0;
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(gatt_cache, GATT_CACHE_SETTINGS_ROOT, NULL,
+			       gatt_cache_settings_set, NULL, NULL);
+#endif
+
+bool gatt_cache_lookup(const bt_addr_le_t *addr, struct gatt_cache_entry *entry)
+{
+	gatt_cache_slot_t *slot;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&cache_lock);
+
+	slot = slot_find(addr);
+	if (slot) {
+		slot->last_used = ++use_counter;
+		*entry = slot->entry;
+	}
+
+	k_spin_unlock(&cache_lock, key);
+
+	return slot != NULL;
+}
+
+bool gatt_cache_entry_valid(const struct gatt_cache_entry *entry, const uint8_t *db_hash)
+{
+	if (!db_hash) {
+		// Nothing to validate against
+		return !entry->has_db_hash && IS_ENABLED(CONFIG_APP_GATT_CACHE_TRUST_NO_HASH);
+	}
+
+	return entry->has_db_hash && memcmp(entry->db_hash, db_hash, GATT_DB_HASH_LEN) == 0;
+}
+
+void gatt_cache_store(const struct gatt_cache_entry *entry)
+{
+	gatt_cache_slot_t *slot;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&cache_lock);
+
+	slot = slot_find(&entry->addr);
+	if (!slot) {
+		slot = slot_alloc();
+	}
+
+	slot->valid = true;
+	slot->last_used = ++use_counter;
+	slot->entry = *entry;
+
+	k_spin_unlock(&cache_lock, key);
+
+	mark_dirty(slot);
+}
+
+void gatt_cache_invalidate(const bt_addr_le_t *addr)
+{
+	gatt_cache_slot_t *slot;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&cache_lock);
+
+	slot = slot_find(addr);
+	if (slot) {
+		slot->valid = false;
+	}
+
+	k_spin_unlock(&cache_lock, key);
+
+	if (slot) {
+		mark_dirty(slot);
+	}
+}
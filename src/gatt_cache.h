@@ -0,0 +1,39 @@
+/* gatt_cache.h - Per-peer GATT handle cache */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GATT_CACHE_H_
+#define GATT_CACHE_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/addr.h>
+
+#define GATT_DB_HASH_LEN 16
+
+// Handles we need to control a bulb, as discovered on a previous connection
+struct gatt_cache_entry {
+	bt_addr_le_t addr;
+	uint16_t color_attr_handle;
+	uint16_t battery_level_value_handle;
+	uint16_t battery_level_ccc_handle;
+	bool has_db_hash;
+	uint8_t db_hash[GATT_DB_HASH_LEN];
+};
+
+// With CONFIG_APP_GATT_CACHE_PERSIST, entries are restored by settings_load()
+
+// Returns true and fills *entry if addr is in the cache
+bool gatt_cache_lookup(const bt_addr_le_t *addr, struct gatt_cache_entry *entry);
+
+// Checks a cached entry against the Database Hash read from the peer.
+// db_hash is NULL when the peer does not expose the characteristic.
+bool gatt_cache_entry_valid(const struct gatt_cache_entry *entry, const uint8_t *db_hash);
+
+// Insert or replace the entry for entry->addr, evicting the least recently used peer if full
+void gatt_cache_store(const struct gatt_cache_entry *entry);
+
+void gatt_cache_invalidate(const bt_addr_le_t *addr);
+
+#endif /* GATT_CACHE_H_ */
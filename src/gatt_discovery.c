@@ -0,0 +1,152 @@
+/* gatt_discovery.c - Single-pass, table driven characteristic discovery */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "gatt_discovery.h"
+
+LOG_MODULE_REGISTER(gatt_discovery, CONFIG_APP_GATT_DISCOVERY_LOG_LEVEL);
+
+static uint8_t descriptor_func(struct bt_conn *conn,
+			       const struct bt_gatt_attr *attr,
+			       struct bt_gatt_discover_params *params);
+
+static void discovery_finish(struct bt_conn *conn, struct gatt_discovery *disc, int err)
+{
+	LOG_DBG("Discovery finished after %u GATT procedure(s) (err %d)", disc->procedures, err);
+
+	disc->done(conn, disc, err);
+}
+
+// Look up the CCCD of the next entry that needs one, one descriptor procedure per entry
+static void discover_next_ccc(struct bt_conn *conn, struct gatt_discovery *disc)
+{
+	int err;
+
+	for (; disc->ccc_idx < disc->count; disc->ccc_idx++) {
+		struct gatt_discovery_result *res = &disc->results[disc->ccc_idx];
+
+		if (!disc->chrcs[disc->ccc_idx].need_ccc || !res->value_handle ||
+		    res->value_handle >= res->end_handle) {
+			continue;
+		}
+
+		disc->params.uuid = BT_UUID_GATT_CCC;
+		disc->params.func = descriptor_func;
+		disc->params.start_handle = res->value_handle + 1;
+		disc->params.end_handle = res->end_handle;
+		disc->params.type = BT_GATT_DISCOVER_DESCRIPTOR;
+
+		err = bt_gatt_discover(conn, &disc->params);
+		if (err) {
+			LOG_ERR("Descriptor discovery failed (err %d)", err);
+			discovery_finish(conn, disc, err);
+			return;
+		}
+
+		disc->procedures++;
+		return;
+	}
+
+	discovery_finish(conn, disc, 0);
+}
+
+static uint8_t descriptor_func(struct bt_conn *conn,
+			       const struct bt_gatt_attr *attr,
+			       struct bt_gatt_discover_params *params)
+{
+	struct gatt_discovery *disc = CONTAINER_OF(params, struct gatt_discovery, params);
+
+	if (attr) {
+		disc->results[disc->ccc_idx].ccc_handle = attr->handle;
+		LOG_DBG("CCCD of characteristic %u at handle %u",
+		       disc->results[disc->ccc_idx].value_handle, attr->handle);
+	}
+
+	disc->ccc_idx++;
+	discover_next_ccc(conn, disc);
+
+	return BT_GATT_ITER_STOP;
+}
+
+static uint8_t characteristic_func(struct bt_conn *conn,
+				   const struct bt_gatt_attr *attr,
+				   struct bt_gatt_discover_params *params)
+{
+	struct gatt_discovery *disc = CONTAINER_OF(params, struct gatt_discovery, params);
+	const struct bt_gatt_chrc *chrc;
+
+	if (!attr) {
+		// Sweep done, fetch descriptors only where they are needed
+		disc->sweep_done_cycles = k_cycle_get_32();
+		disc->ccc_idx = 0;
+		discover_next_ccc(conn, disc);
+		return BT_GATT_ITER_STOP;
+	}
+
+	// A new declaration closes the handle range of the previous match
+	if (disc->open_idx >= 0) {
+		disc->results[disc->open_idx].end_handle = attr->handle - 1;
+		disc->open_idx = -1;
+	}
+
+	chrc = attr->user_data;
+
+	for (size_t i = 0; i < disc->count; i++) {
+		struct gatt_discovery_result *res = &disc->results[i];
+
+		if (res->value_handle || bt_uuid_cmp(chrc->uuid, disc->chrcs[i].uuid)) {
+			continue;
+		}
+
+		res->value_handle = chrc->value_handle;
+		res->end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+		res->properties = chrc->properties;
+		disc->open_idx = i;
+
+		LOG_DBG("Discovered characteristic %zu with value handle %u", i, res->value_handle);
+		break;
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+int gatt_discovery_start(struct bt_conn *conn, struct gatt_discovery *disc,
+			 const struct gatt_discovery_chrc *chrcs,
+			 struct gatt_discovery_result *results, size_t count,
+			 gatt_discovery_done_t done)
+{
+	int err;
+
+	(void)memset(disc, 0, sizeof(*disc));
+	(void)memset(results, 0, count * sizeof(*results));
+
+	disc->chrcs = chrcs;
+	disc->results = results;
+	disc->count = count;
+	disc->done = done;
+	disc->open_idx = -1;
+
+	// No UUID filter: every characteristic declaration in one sweep
+	disc->params.uuid = NULL;
+	disc->params.func = characteristic_func;
+	disc->params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	disc->params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	disc->params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+	err = bt_gatt_discover(conn, &disc->params);
+	if (err) {
+		return err;
+	}
+
+	disc->procedures++;
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+/* gatt_discovery.h - Single-pass, table driven characteristic discovery */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GATT_DISCOVERY_H_
+#define GATT_DISCOVERY_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+// A characteristic we want to find on the peer
+struct gatt_discovery_chrc {
+	const struct bt_uuid *uuid;
+	// Also look up the CCCD (for notifications/indications)
+	bool need_ccc;
+};
+
+// What was found for the matching gatt_discovery_chrc entry (0 == not found)
+struct gatt_discovery_result {
+	uint16_t value_handle;
+	uint16_t end_handle;
+	uint16_t ccc_handle;
+	uint8_t properties;
+};
+
+struct gatt_discovery;
+
+typedef void (*gatt_discovery_done_t)(struct bt_conn *conn, struct gatt_discovery *disc, int err);
+
+struct gatt_discovery {
+	struct bt_gatt_discover_params params;
+
+	const struct gatt_discovery_chrc *chrcs;
+	struct gatt_discovery_result *results;
+	size_t count;
+	gatt_discovery_done_t done;
+
+	// Index of the entry whose handle range is still open, or -1
+	int open_idx;
+	// Next entry to look up a CCCD for
+	size_t ccc_idx;
+	// Number of bt_gatt_discover() procedures issued
+	uint16_t procedures;
+	// k_cycle_get_32() when the characteristic sweep completed
+	uint32_t sweep_done_cycles;
+};
+
+// Discover all chrcs[0..count-1] with one characteristic sweep over the whole
+// database, followed by one descriptor lookup per entry that needs a CCCD.
+// results must have room for count entries. done is called from the BT RX
+// context once everything has been found, or on error.
+int gatt_discovery_start(struct bt_conn *conn, struct gatt_discovery *disc,
+			 const struct gatt_discovery_chrc *chrcs,
+			 struct gatt_discovery_result *results, size_t count,
+			 gatt_discovery_done_t done);
+
+#endif /* GATT_DISCOVERY_H_ */
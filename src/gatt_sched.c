@@ -0,0 +1,227 @@
+/* gatt_sched.c - Fair, prioritised scheduling of ATT requests across links */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "gatt_sched.h"
+
+LOG_MODULE_REGISTER(gatt_sched, CONFIG_APP_GATT_SCHED_LOG_LEVEL);
+
+BUILD_ASSERT(CONFIG_APP_GATT_SCHED_WRITE_RESERVE < CONFIG_APP_GATT_SCHED_MAX_IN_FLIGHT,
+	     "no slot left for setup and reads");
+
+// Slots setup and reads may hold, the rest is kept for colour writes
+#define NON_WRITE_MAX (CONFIG_APP_GATT_SCHED_MAX_IN_FLIGHT - CONFIG_APP_GATT_SCHED_WRITE_RESERVE)
+
+struct sched_link {
+	sys_slist_t queues[GATT_SCHED_PRIO_COUNT];
+	uint8_t in_flight;
+	// Bumped on disconnect
+	uint8_t epoch;
+};
+
+static struct {
+	struct k_spinlock lock;
+	// Indexed by bt_conn_index()
+	struct sched_link links[CONFIG_BT_MAX_CONN];
+	// Link each priority is served from next
+	uint8_t cursor[GATT_SCHED_PRIO_COUNT];
+	uint8_t in_flight;
+	// Some context is issuing requests, the others only queue theirs
+	bool dispatching;
+	struct gatt_sched_stats stats;
+} sched;
+
+// Highest priority op, taking turns between the links. Called with the lock held.
+static struct gatt_sched_op *next_op(void)
+{
+	// Only writes may take the reserved slots
+	size_t prio_count = sched.in_flight < NON_WRITE_MAX ? GATT_SCHED_PRIO_COUNT :
+							       GATT_SCHED_PRIO_WRITE + 1;
+
+	for (size_t prio = 0; prio < prio_count; prio++) {
+		for (size_t n = 0; n < ARRAY_SIZE(sched.links); n++) {
+			size_t idx = (sched.cursor[prio] + n) % ARRAY_SIZE(sched.links);
+			sys_snode_t *node = sys_slist_get(&sched.links[idx].queues[prio]);
+			struct gatt_sched_op *op;
+
+			if (!node) {
+				continue;
+			}
+
+			sched.cursor[prio] = (idx + 1) % ARRAY_SIZE(sched.links);
+			op = CONTAINER_OF(node, struct gatt_sched_op, node);
+			op->queued = false;
+
+			return op;
+		}
+	}
+
+	return NULL;
+}
+
+// Called with the lock held
+static void release(struct sched_link *link)
+{
+	if (!link->in_flight) {
+		return;
+	}
+
+	link->in_flight--;
+	sched.in_flight--;
+}
+
+static void dispatch(void)
+{
+	struct gatt_sched_op *op;
+	struct sched_link *link;
+	k_spinlock_key_t key;
+	int err;
+
+	key = k_spin_lock(&sched.lock);
+
+	if (sched.dispatching) {
+		// The running dispatch picks the new state up before it returns
+		k_spin_unlock(&sched.lock, key);
+		return;
+	}
+
+	sched.dispatching = true;
+
+	while (sched.in_flight < CONFIG_APP_GATT_SCHED_MAX_IN_FLIGHT && (op = next_op())) {
+		link = &sched.links[op->link];
+		op->epoch = link->epoch;
+		link->in_flight++;
+		sched.in_flight++;
+		sched.stats.issued++;
+		sched.stats.peak_in_flight = MAX(sched.stats.peak_in_flight, sched.in_flight);
+
+		k_spin_unlock(&sched.lock, key);
+
+		err = op->issue(op);
+
+		key = k_spin_lock(&sched.lock);
+
+		if (err) {
+			LOG_DBG("Request on link %u not issued (err %d)", op->link, err);
+			sched.stats.failed++;
+			release(link);
+		}
+	}
+
+	sched.dispatching = false;
+
+	k_spin_unlock(&sched.lock, key);
+}
+
+void gatt_sched_op_init(struct gatt_sched_op *op, enum gatt_sched_prio prio,
+			gatt_sched_issue_t issue)
+{
+	op->conn = NULL;
+	op->issue = issue;
+	op->prio = prio;
+	op->link = 0;
+	op->epoch = 0;
+	op->queued = false;
+}
+
+int gatt_sched_submit(struct gatt_sched_op *op, struct bt_conn *conn)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&sched.lock);
+
+	if (op->queued) {
+		k_spin_unlock(&sched.lock, key);
+		return -EALREADY;
+	}
+
+	op->conn = conn;
+	op->link = bt_conn_index(conn);
+	op->queued = true;
+	sys_slist_append(&sched.links[op->link].queues[op->prio], &op->node);
+
+	if (sched.in_flight >= CONFIG_APP_GATT_SCHED_MAX_IN_FLIGHT) {
+		sched.stats.deferred++;
+	}
+
+	k_spin_unlock(&sched.lock, key);
+
+	dispatch();
+
+	return 0;
+}
+
+void gatt_sched_cancel(struct gatt_sched_op *op)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&sched.lock);
+
+	if (op->queued) {
+		(void)sys_slist_find_and_remove(&sched.links[op->link].queues[op->prio], &op->node);
+		op->queued = false;
+	}
+
+	k_spin_unlock(&sched.lock, key);
+}
+
+void gatt_sched_done(struct gatt_sched_op *op)
+{
+	struct sched_link *link = &sched.links[op->link];
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&sched.lock);
+	// Slots of a link that is gone were settled on disconnect
+	if (op->epoch == link->epoch) {
+		release(link);
+	}
+	k_spin_unlock(&sched.lock, key);
+
+	dispatch();
+}
+
+void gatt_sched_get_stats(struct gatt_sched_stats *stats)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&sched.lock);
+	*stats = sched.stats;
+	stats->in_flight = sched.in_flight;
+	k_spin_unlock(&sched.lock, key);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	struct sched_link *link = &sched.links[bt_conn_index(conn)];
+	k_spinlock_key_t key;
+	sys_snode_t *node;
+
+	key = k_spin_lock(&sched.lock);
+
+	for (size_t prio = 0; prio < GATT_SCHED_PRIO_COUNT; prio++) {
+		while ((node = sys_slist_get(&link->queues[prio]))) {
+			CONTAINER_OF(node, struct gatt_sched_op, node)->queued = false;
+		}
+	}
+
+	// Whatever was in flight on the link will not hold the others up
+	sched.in_flight -= link->in_flight;
+	link->in_flight = 0;
+	link->epoch++;
+
+	k_spin_unlock(&sched.lock, key);
+
+	dispatch();
+}
+
+BT_CONN_CB_DEFINE(gatt_sched_callbacks) = {
+	.disconnected = disconnected,
+};
@@ -0,0 +1,71 @@
+/* gatt_sched.h - Fair, prioritised scheduling of ATT requests across links */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GATT_SCHED_H_
+#define GATT_SCHED_H_
+
+#include <zephyr/types.h>
+#include <zephyr/sys/slist.h>
+#include <zephyr/bluetooth/conn.h>
+
+// Served in this order, round robin over the links within each priority
+enum gatt_sched_prio {
+	// Colour writes, what the user is waiting for
+	GATT_SCHED_PRIO_WRITE,
+	// Bring-up of a new link: Database Hash, discovery, subscription. Like
+	// reads, kept off the CONFIG_APP_GATT_SCHED_WRITE_RESERVE last slots.
+	GATT_SCHED_PRIO_SETUP,
+	// Telemetry reads
+	GATT_SCHED_PRIO_READ,
+	GATT_SCHED_PRIO_COUNT
+};
+
+struct gatt_sched_op;
+
+// Issue the ATT request(s) of op. Returns 0 when the op holds a slot and
+// gatt_sched_done() follows once it completed. On error nothing is in
+// flight and the owner of op deals with the failure itself.
+typedef int (*gatt_sched_issue_t)(struct gatt_sched_op *op);
+
+// Embedded by the owner, queued at most once at a time
+struct gatt_sched_op {
+	sys_snode_t node;
+	struct bt_conn *conn;
+	gatt_sched_issue_t issue;
+	uint8_t prio;
+	uint8_t link;
+	// Link epoch the op was issued in, see gatt_sched_done()
+	uint8_t epoch;
+	bool queued;
+};
+
+struct gatt_sched_stats {
+	uint32_t issued;
+	// Submitted while CONFIG_APP_GATT_SCHED_MAX_IN_FLIGHT requests were out
+	uint32_t deferred;
+	uint32_t failed;
+	uint8_t in_flight;
+	uint8_t peak_in_flight;
+};
+
+void gatt_sched_op_init(struct gatt_sched_op *op, enum gatt_sched_prio prio,
+			gatt_sched_issue_t issue);
+
+// Queue op for conn. Issued right away (possibly before this returns) when
+// fewer than CONFIG_APP_GATT_SCHED_MAX_IN_FLIGHT requests are out.
+// Returns -EALREADY if op is queued already.
+int gatt_sched_submit(struct gatt_sched_op *op, struct bt_conn *conn);
+
+// Drop op if it is still queued. Queued ops of a link are dropped on disconnect.
+void gatt_sched_cancel(struct gatt_sched_op *op);
+
+// A request issued through op completed, the next one may go out. Slots of a
+// link are settled when it disconnects, completions from before are ignored.
+void gatt_sched_done(struct gatt_sched_op *op);
+
+void gatt_sched_get_stats(struct gatt_sched_stats *stats);
+
+#endif /* GATT_SCHED_H_ */
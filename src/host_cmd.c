@@ -0,0 +1,477 @@
+/* host_cmd.c - Binary command link to a host over the async UART API */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "host_cmd.h"
+
+LOG_MODULE_REGISTER(host_cmd, CONFIG_APP_HOST_CMD_LOG_LEVEL);
+
+#define HOST_UART_NODE DT_CHOSEN(app_host_uart)
+
+#define QUEUE_DEPTH CONFIG_APP_HOST_CMD_QUEUE_DEPTH
+
+BUILD_ASSERT(IS_POWER_OF_TWO(QUEUE_DEPTH), "queue depth must be a power of two");
+
+// One queue per connection slot, the last one for HOST_CMD_PEER_ALL
+#define QUEUE_ALL CONFIG_BT_MAX_CONN
+#define QUEUE_COUNT (CONFIG_BT_MAX_CONN + 1)
+
+// Largest frame we send: SOF, event, peer, length, data and CRC
+#define TX_FRAME_MAX (HOST_CMD_EVT_DATA_MAX + 5)
+#define TX_FRAMES 4
+
+enum parse_state {
+	PARSE_SOF,
+	PARSE_SEQ,
+	PARSE_LEN,
+	PARSE_OPCODE,
+	PARSE_PEER,
+	PARSE_ARGS,
+	PARSE_CRC,
+};
+
+// Commands are committed per frame: the parser fills slots past head and
+// only publishes them once the CRC checked out. Single producer (UART ISR),
+// single consumer (exec_work), like notify_ring.
+struct cmd_queue {
+	struct host_cmd slots[QUEUE_DEPTH];
+	atomic_t head;
+	atomic_t tail;
+	// Producer only: head plus the slots filled by the frame being parsed
+	atomic_val_t stage;
+};
+
+static const struct device *const uart = DEVICE_DT_GET(HOST_UART_NODE);
+
+static struct cmd_queue queues[QUEUE_COUNT];
+
+static const uint8_t args_len[] = {
+	[HOST_CMD_SET_COLOR] = sizeof(uint32_t),
+	[HOST_CMD_READ_STATE] = 0,
+	[HOST_CMD_CONN_PARAM] = 3 * sizeof(uint16_t),
+	[HOST_CMD_DISCONNECT] = 0,
+};
+
+static struct {
+	enum parse_state state;
+	uint8_t seq;
+	// Command bytes of the frame still to come
+	uint8_t remaining;
+	uint8_t crc;
+	uint8_t status;
+	uint8_t accepted;
+	uint8_t opcode;
+	uint8_t arg_idx;
+	// Slot being filled, or scratch when the command is dropped
+	struct host_cmd *cmd;
+	struct host_cmd scratch;
+} parser;
+
+static uint8_t rx_bufs[2][CONFIG_APP_HOST_CMD_RX_BUF_SIZE];
+static uint8_t rx_next;
+
+static struct {
+	struct k_spinlock lock;
+	uint8_t frames[TX_FRAMES][TX_FRAME_MAX];
+	uint8_t lens[TX_FRAMES];
+	uint8_t head;
+	uint8_t count;
+	bool busy;
+} tx;
+
+static struct k_work_q *exec_queue;
+static host_cmd_exec_t exec_handler;
+
+static void exec_work_handler(struct k_work *work);
+static K_WORK_DEFINE(exec_work, exec_work_handler);
+
+static struct {
+	struct k_spinlock lock;
+	struct host_cmd_stats stats;
+} stats;
+
+static void stats_add(uint32_t *counter, uint32_t n)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats.lock);
+
+	*counter += n;
+	k_spin_unlock(&stats.lock, key);
+}
+
+// Start sending the oldest queued frame. Called with tx.lock held.
+static void tx_kick(void)
+{
+	while (!tx.busy && tx.count) {
+		if (!uart_tx(uart, tx.frames[tx.head], tx.lens[tx.head], SYS_FOREVER_US)) {
+			tx.busy = true;
+			return;
+		}
+
+		// Dropping the frame beats stalling every one queued after it, try the next
+		tx.head = (tx.head + 1) % TX_FRAMES;
+		tx.count--;
+		stats_add(&stats.stats.tx_dropped, 1);
+	}
+}
+
+static int tx_frame(uint8_t sof, const uint8_t *hdr, size_t hdr_len, const void *data, size_t len)
+{
+	k_spinlock_key_t key;
+	uint8_t *frame;
+	size_t n;
+
+	if (1 + hdr_len + len + 1 > TX_FRAME_MAX) {
+		return -EMSGSIZE;
+	}
+
+	key = k_spin_lock(&tx.lock);
+
+	if (tx.count == TX_FRAMES) {
+		k_spin_unlock(&tx.lock, key);
+		stats_add(&stats.stats.tx_dropped, 1);
+		return -ENOMEM;
+	}
+
+	frame = tx.frames[(tx.head + tx.count) % TX_FRAMES];
+	frame[0] = sof;
+	memcpy(&frame[1], hdr, hdr_len);
+	memcpy(&frame[1 + hdr_len], data, len);
+	n = 1 + hdr_len + len;
+	frame[n] = crc8_ccitt(0, &frame[1], n - 1);
+	tx.lens[(tx.head + tx.count) % TX_FRAMES] = n + 1;
+	tx.count++;
+
+	tx_kick();
+
+	k_spin_unlock(&tx.lock, key);
+
+	return 0;
+}
+
+int host_cmd_event(uint8_t event, uint8_t peer, const void *data, size_t len)
+{
+	const uint8_t hdr[] = { event, peer, len };
+
+	return tx_frame(HOST_CMD_EVT_SOF, hdr, sizeof(hdr), data, len);
+}
+
+static void frame_end(bool commit)
+{
+	// Nothing of a rejected frame runs, whatever was parsed before the error
+	const uint8_t hdr[] = { parser.seq, parser.status, commit ? parser.accepted : 0 };
+	// Latency counts from the end of the frame, however many chunks it came in
+	uint32_t now = k_cycle_get_32();
+
+	for (size_t i = 0; i < ARRAY_SIZE(queues); i++) {
+		struct cmd_queue *q = &queues[i];
+
+		if (commit) {
+			for (atomic_val_t t = atomic_get(&q->head); t != q->stage; t++) {
+				q->slots[t & (QUEUE_DEPTH - 1)].rx_cycles = now;
+			}
+			atomic_set(&q->head, q->stage);
+		} else {
+			q->stage = atomic_get(&q->head);
+		}
+	}
+
+	if (commit && parser.accepted) {
+		k_work_submit_to_queue(exec_queue, &exec_work);
+	}
+
+	(void)tx_frame(HOST_CMD_ACK_SOF, hdr, sizeof(hdr), NULL, 0);
+
+	if (commit) {
+		stats_add(&stats.stats.frames, 1);
+		stats_add(&stats.stats.commands, parser.accepted);
+	} else {
+		stats_add(&stats.stats.bad_frames, 1);
+	}
+}
+
+// Pick the slot the peer's next command is decoded into
+static void cmd_begin(uint8_t peer)
+{
+	struct cmd_queue *q = &queues[peer < CONFIG_BT_MAX_CONN ? peer : QUEUE_ALL];
+
+	if (peer >= CONFIG_BT_MAX_CONN && peer != HOST_CMD_PEER_ALL) {
+		parser.status = HOST_CMD_ERR_FORMAT;
+		parser.cmd = &parser.scratch;
+	} else if ((atomic_val_t)(q->stage - atomic_get(&q->tail)) >= QUEUE_DEPTH) {
+		parser.status = HOST_CMD_ERR_FULL;
+		parser.cmd = &parser.scratch;
+		stats_add(&stats.stats.dropped, 1);
+	} else {
+		parser.cmd = &q->slots[q->stage & (QUEUE_DEPTH - 1)];
+	}
+
+	parser.cmd->opcode = parser.opcode;
+	parser.cmd->peer = peer;
+}
+
+static void cmd_end(void)
+{
+	struct cmd_queue *q;
+
+	if (parser.cmd == &parser.scratch) {
+		return;
+	}
+
+	q = &queues[MIN(parser.cmd->peer, QUEUE_ALL)];
+	q->stage++;
+	parser.accepted++;
+}
+
+// Decode bytes straight out of the UART buffer into the command queues
+static void parse(const uint8_t *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		uint8_t b = data[i];
+
+		if (parser.state != PARSE_SOF && parser.state != PARSE_CRC) {
+			parser.crc = crc8_ccitt(parser.crc, &b, 1);
+		}
+
+		switch (parser.state) {
+		case PARSE_SOF:
+			if (b == HOST_CMD_SOF) {
+				parser.crc = 0;
+				parser.status = HOST_CMD_OK;
+				parser.accepted = 0;
+				parser.state = PARSE_SEQ;
+			}
+			break;
+
+		case PARSE_SEQ:
+			parser.seq = b;
+			parser.state = PARSE_LEN;
+			break;
+
+		case PARSE_LEN:
+			parser.remaining = b;
+			parser.state = b ? PARSE_OPCODE : PARSE_CRC;
+			break;
+
+		case PARSE_OPCODE:
+			parser.opcode = b;
+			parser.remaining--;
+			if (b >= ARRAY_SIZE(args_len) || !b || !parser.remaining) {
+				// Without the length of the arguments the rest cannot be framed
+				parser.status = HOST_CMD_ERR_FORMAT;
+				parser.state = PARSE_CRC;
+				break;
+			}
+			parser.state = PARSE_PEER;
+			break;
+
+		case PARSE_PEER:
+			parser.remaining--;
+			if (parser.remaining < args_len[parser.opcode]) {
+				parser.status = HOST_CMD_ERR_FORMAT;
+				parser.state = PARSE_CRC;
+				break;
+			}
+			cmd_begin(b);
+			parser.arg_idx = 0;
+			if (args_len[parser.opcode]) {
+				parser.state = PARSE_ARGS;
+				break;
+			}
+			cmd_end();
+			parser.state = parser.remaining ? PARSE_OPCODE : PARSE_CRC;
+			break;
+
+		case PARSE_ARGS:
+			parser.cmd->args[parser.arg_idx++] = b;
+			parser.remaining--;
+			if (parser.arg_idx < args_len[parser.opcode]) {
+				break;
+			}
+			cmd_end();
+			parser.state = parser.remaining ? PARSE_OPCODE : PARSE_CRC;
+			break;
+
+		case PARSE_CRC:
+			// Skip what is left of a malformed frame, the CRC still covers it
+			if (parser.remaining) {
+				parser.crc = crc8_ccitt(parser.crc, &b, 1);
+				parser.remaining--;
+				break;
+			}
+			if (b != parser.crc) {
+				parser.status = HOST_CMD_ERR_CRC;
+			}
+			frame_end(parser.status != HOST_CMD_ERR_CRC &&
+				  parser.status != HOST_CMD_ERR_FORMAT);
+			parser.state = PARSE_SOF;
+			break;
+		}
+	}
+}
+
+static void uart_cb(const struct device *dev, struct uart_event *evt, void *user_data)
+{
+	k_spinlock_key_t key;
+	int err;
+
+	switch (evt->type) {
+	case UART_RX_RDY:
+		parse(evt->data.rx.buf + evt->data.rx.offset, evt->data.rx.len);
+		break;
+
+	case UART_RX_BUF_REQUEST:
+		(void)uart_rx_buf_rsp(dev, rx_bufs[rx_next], sizeof(rx_bufs[0]));
+		rx_next ^= 1;
+		break;
+
+	case UART_RX_DISABLED:
+		// Stopped by a line error; start over with a clean parser
+		parser.state = PARSE_SOF;
+		rx_next = 1;
+		err = uart_rx_enable(dev, rx_bufs[0], sizeof(rx_bufs[0]),
+				     CONFIG_APP_HOST_CMD_RX_TIMEOUT_US);
+		if (err) {
+			LOG_ERR("Cannot restart reception (err %d)", err);
+		}
+		break;
+
+	case UART_RX_STOPPED:
+		LOG_WRN("Reception stopped (reason %d)", evt->data.rx_stop.reason);
+		break;
+
+	case UART_TX_DONE:
+	case UART_TX_ABORTED:
+		key = k_spin_lock(&tx.lock);
+		tx.busy = false;
+		tx.head = (tx.head + 1) % TX_FRAMES;
+		tx.count--;
+		tx_kick();
+		k_spin_unlock(&tx.lock, key);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void drain(struct cmd_queue *q)
+{
+	atomic_val_t t = atomic_get(&q->tail);
+
+	for (; t != atomic_get(&q->head); t++) {
+		exec_handler(&q->slots[t & (QUEUE_DEPTH - 1)]);
+		// Hand the slot back as soon as it is done with
+		atomic_set(&q->tail, t + 1);
+	}
+}
+
+static void exec_work_handler(struct k_work *work)
+{
+	// Broadcasts first, they were most likely meant to come before per-bulb tweaks
+	drain(&queues[QUEUE_ALL]);
+
+	for (size_t i = 0; i < CONFIG_BT_MAX_CONN; i++) {
+		drain(&queues[i]);
+	}
+}
+
+void host_cmd_latency(uint32_t rx_cycles, uint32_t done_cycles)
+{
+	uint32_t us = k_cyc_to_us_floor32(done_cycles - rx_cycles);
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&stats.lock);
+
+	if (!stats.stats.latency_count++) {
+		stats.stats.latency_min_us = us;
+	}
+	stats.stats.latency_min_us = MIN(stats.stats.latency_min_us, us);
+	stats.stats.latency_max_us = MAX(stats.stats.latency_max_us, us);
+	stats.stats.latency_sum_us += us;
+
+	k_spin_unlock(&stats.lock, key);
+
+	LOG_DBG("Host to air in %u us", us);
+}
+
+void host_cmd_get_stats(struct host_cmd_stats *out)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&stats.lock);
+	*out = stats.stats;
+	k_spin_unlock(&stats.lock, key);
+}
+
+int host_cmd_init(struct k_work_q *queue, host_cmd_exec_t exec)
+{
+	int err;
+
+	if (!device_is_ready(uart)) {
+		LOG_ERR("Host UART not ready");
+		return -ENODEV;
+	}
+
+	exec_queue = queue;
+	exec_handler = exec;
+
+	err = uart_callback_set(uart, uart_cb, NULL);
+	if (err) {
+		LOG_ERR("UART has no async API (err %d)", err);
+		return err;
+	}
+
+	rx_next = 1;
+	err = uart_rx_enable(uart, rx_bufs[0], sizeof(rx_bufs[0]), CONFIG_APP_HOST_CMD_RX_TIMEOUT_US);
+	if (err) {
+		LOG_ERR("Cannot enable reception (err %d)", err);
+		return err;
+	}
+
+	LOG_INF("Host commands on %s", uart->name);
+
+	return 0;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_host_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct host_cmd_stats s;
+	uint32_t avg;
+
+	host_cmd_get_stats(&s);
+
+	shell_print(sh, "frames %u, bad %u, commands %u, dropped %u, tx dropped %u",
+		    s.frames, s.bad_frames, s.commands, s.dropped, s.tx_dropped);
+
+	if (!s.latency_count) {
+		return 0;
+	}
+
+	avg = (uint32_t)(s.latency_sum_us / s.latency_count);
+	shell_print(sh, "host to air n=%u min %u.%03u avg %u.%03u max %u.%03u ms",
+		    s.latency_count, s.latency_min_us / 1000U, s.latency_min_us % 1000U,
+		    avg / 1000U, avg % 1000U, s.latency_max_us / 1000U, s.latency_max_us % 1000U);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(host_cmds,
+	SHELL_CMD(stats, NULL, "Frame counters and host to air latency", cmd_host_stats),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(host, &host_cmds, "Host command link", NULL);
+#endif /* CONFIG_SHELL */
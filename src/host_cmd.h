@@ -0,0 +1,99 @@
+/* host_cmd.h - Binary command link to a host over the async UART API */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_CMD_H_
+#define HOST_CMD_H_
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+
+// Host to central frame, all fields little endian:
+//
+//   0xA5 | seq | len | len bytes of commands | CRC-8 (CCITT) of seq, len and commands
+//
+// Every command is an opcode, a peer and the opcode's arguments. A frame is
+// acknowledged with
+//
+//   0x5A | seq | status | commands accepted | CRC-8
+//
+// and events from the central are sent as
+//
+//   0x5B | event | peer | len | len bytes of data | CRC-8
+#define HOST_CMD_SOF 0xA5
+#define HOST_CMD_ACK_SOF 0x5A
+#define HOST_CMD_EVT_SOF 0x5B
+
+// Peer index addressing every ready bulb
+#define HOST_CMD_PEER_ALL 0xFF
+
+enum host_cmd_opcode {
+	// u32 WRGB colour, converted to the bulb's own encoding
+	HOST_CMD_SET_COLOR = 0x01,
+	// Read colour and battery level back, answered with HOST_EVT_STATE
+	HOST_CMD_READ_STATE = 0x02,
+	// u16 interval (1.25 ms units), u16 latency, u16 timeout (10 ms units)
+	HOST_CMD_CONN_PARAM = 0x03,
+	HOST_CMD_DISCONNECT = 0x04,
+};
+
+enum host_cmd_status {
+	HOST_CMD_OK,
+	HOST_CMD_ERR_CRC,
+	// Malformed frame: unknown opcode, or a command running past the frame end
+	HOST_CMD_ERR_FORMAT,
+	// Some commands were dropped because their peer's queue was full
+	HOST_CMD_ERR_FULL,
+};
+
+enum host_cmd_event {
+	// Colour as read (4 bytes, bulb encoding) and battery level in percent
+	HOST_EVT_STATE = 0x01,
+	// Battery level time series of the fleet member peer, see battery_log.h
+	HOST_EVT_BATTERY = 0x02,
+};
+
+// Largest data carried by an event frame
+#define HOST_CMD_EVT_DATA_MAX 48
+
+struct host_cmd {
+	uint8_t opcode;
+	uint8_t peer;
+	// Stored here byte by byte straight from the UART buffer, still little endian
+	uint8_t args[6];
+	// Cycle counter when its frame was complete and checked
+	uint32_t rx_cycles;
+};
+
+// Runs on the queue given to host_cmd_init() for every accepted command,
+// in order per peer. Peer is a connection slot or HOST_CMD_PEER_ALL.
+typedef void (*host_cmd_exec_t)(const struct host_cmd *cmd);
+
+struct host_cmd_stats {
+	uint32_t frames;
+	uint32_t bad_frames;
+	uint32_t commands;
+	uint32_t dropped;
+	uint32_t tx_dropped;
+	// Host to air: end of the frame to the completion of the colour write
+	uint32_t latency_count;
+	uint32_t latency_min_us;
+	uint32_t latency_max_us;
+	uint64_t latency_sum_us;
+};
+
+// Start receiving on the app,host-uart chosen node
+int host_cmd_init(struct k_work_q *queue, host_cmd_exec_t exec);
+
+// Queue an event frame behind the ones still going out. Dropped (and
+// counted) with -ENOMEM while all of the TX frames are taken.
+int host_cmd_event(uint8_t event, uint8_t peer, const void *data, size_t len);
+
+// A command received at rx_cycles reached the air at done_cycles
+void host_cmd_latency(uint32_t rx_cycles, uint32_t done_cycles);
+
+void host_cmd_get_stats(struct host_cmd_stats *stats);
+
+#endif /* HOST_CMD_H_ */
@@ -0,0 +1,390 @@
+/* idle_policy.c - Slow links down and park the scan while nothing is sent */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "idle_policy.h"
+
+LOG_MODULE_REGISTER(idle_policy, CONFIG_APP_IDLE_LOG_LEVEL);
+
+// The supervision timeout has to outlast the events a bulb may sleep through
+BUILD_ASSERT(CONFIG_APP_IDLE_TIMEOUT * 4 >
+	     (1 + CONFIG_APP_IDLE_LATENCY) * CONFIG_APP_IDLE_INTERVAL,
+	     "supervision timeout too short for the idle interval and latency");
+
+// While commands are being sent: what link tuning negotiated
+static const struct bt_le_conn_param active_param =
+	BT_LE_CONN_PARAM_INIT(CONFIG_APP_LINK_INTERVAL_MIN, CONFIG_APP_LINK_INTERVAL_MAX,
+			      CONFIG_APP_LINK_LATENCY, CONFIG_APP_LINK_TIMEOUT);
+
+static const struct bt_le_conn_param idle_param =
+	BT_LE_CONN_PARAM_INIT(CONFIG_APP_IDLE_INTERVAL, CONFIG_APP_IDLE_INTERVAL,
+			      CONFIG_APP_IDLE_LATENCY, CONFIG_APP_IDLE_TIMEOUT);
+
+static struct {
+	struct k_work_q *queue;
+	const struct idle_policy_cb *cb;
+	atomic_t idle;
+	// k_uptime_get_32() of the last command
+	atomic_t last_activity;
+	// Indexed by bt_conn_index(), links following the policy. Each holds a
+	// reference, dropped on disconnect; read through link_get().
+	struct bt_conn *links[CONFIG_BT_MAX_CONN];
+	// Links still to be moved to the parameters of the current mode
+	atomic_t pending;
+	uint32_t last_sample;
+	uint32_t scan_permille;
+	struct k_spinlock lock;
+	struct idle_policy_stats stats;
+} policy;
+
+BUILD_ASSERT(CONFIG_BT_MAX_CONN <= sizeof(atomic_val_t) * 8, "one pending bit per link");
+
+static void tick_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(tick_work, tick_handler);
+
+static void changed_handler(struct k_work *work);
+static K_WORK_DEFINE(changed_work, changed_handler);
+
+static void wake_handler(struct k_work *work);
+static K_WORK_DEFINE(wake_work, wake_handler);
+
+// New reference to the link at index, NULL if none. Released by the caller.
+static struct bt_conn *link_get(size_t index)
+{
+	struct bt_conn *conn;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&policy.lock);
+	conn = policy.links[index] ? bt_conn_ref(policy.links[index]) : NULL;
+	k_spin_unlock(&policy.lock, key);
+
+	return conn;
+}
+
+static bool param_in_use(const struct bt_conn_info *info, const struct bt_le_conn_param *param)
+{
+	return info->le.interval >= param->interval_min &&
+	       info->le.interval <= param->interval_max &&
+	       info->le.latency == param->latency;
+}
+
+// Request the parameters of the current mode on every pending link
+static void reconcile(void)
+{
+	const struct bt_le_conn_param *param = atomic_get(&policy.idle) ? &idle_param : &active_param;
+	struct bt_conn_info info;
+	int err;
+
+	for (size_t i = 0; i < ARRAY_SIZE(policy.links); i++) {
+		struct bt_conn *conn;
+
+		if (!atomic_test_bit(&policy.pending, i)) {
+			continue;
+		}
+
+		conn = link_get(i);
+		if (!conn) {
+			continue;
+		}
+
+		if (bt_conn_get_info(conn, &info) || param_in_use(&info, param)) {
+			atomic_clear_bit(&policy.pending, i);
+			bt_conn_unref(conn);
+			continue;
+		}
+
+		// Stays pending on failure, e.g. while another update is in progress
+		err = bt_conn_le_param_update(conn, param);
+		if (!err || err == -EALREADY) {
+			atomic_clear_bit(&policy.pending, i);
+		} else {
+			LOG_DBG("Parameter update of link %u deferred (err %d)", (unsigned int)i, err);
+		}
+		bt_conn_unref(conn);
+	}
+}
+
+static void mark_all_pending(void)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&policy.lock);
+	for (size_t i = 0; i < ARRAY_SIZE(policy.links); i++) {
+		if (policy.links[i]) {
+			atomic_set_bit(&policy.pending, i);
+		}
+	}
+	k_spin_unlock(&policy.lock, key);
+}
+
+static size_t link_count(void)
+{
+	k_spinlock_key_t key;
+	size_t count = 0;
+
+	key = k_spin_lock(&policy.lock);
+	for (size_t i = 0; i < ARRAY_SIZE(policy.links); i++) {
+		count += policy.links[i] != NULL;
+	}
+	k_spin_unlock(&policy.lock, key);
+
+	return count;
+}
+
+// Radio time for elapsed_ms at interval (1.25 ms units), in us
+static uint64_t events_us(uint32_t elapsed_ms, uint16_t interval)
+{
+	return ((uint64_t)elapsed_ms * 1000U * CONFIG_APP_IDLE_CONN_EVENT_US) / (interval * 1250U);
+}
+
+static void account(void)
+{
+	uint32_t now = k_uptime_get_32();
+	uint32_t elapsed_ms = now - policy.last_sample;
+	uint32_t scan = policy.cb->scan_permille();
+	uint64_t radio_active = 0;
+	uint64_t bulb_active = 0;
+	uint64_t radio = 0;
+	uint64_t bulb = 0;
+	struct bt_conn_info info;
+	k_spinlock_key_t key;
+	uint64_t us;
+	int err;
+
+	policy.last_sample = now;
+
+	for (size_t i = 0; i < ARRAY_SIZE(policy.links); i++) {
+		struct bt_conn *conn = link_get(i);
+
+		if (!conn) {
+			continue;
+		}
+
+		err = bt_conn_get_info(conn, &info);
+		bt_conn_unref(conn);
+		if (err || !info.le.interval) {
+			continue;
+		}
+
+		// The central attends every event, a bulb only one in latency + 1
+		us = events_us(elapsed_ms, info.le.interval);
+		radio += us;
+		bulb += us / (info.le.latency + 1U);
+
+		us = events_us(elapsed_ms, active_param.interval_min);
+		radio_active += us;
+		bulb_active += us / (active_param.latency + 1U);
+	}
+
+	// A parked scan is accounted as if it still ran at its last duty cycle
+	if (scan) {
+		policy.scan_permille = scan;
+	}
+	radio += (uint64_t)elapsed_ms * scan;
+	radio_active += (uint64_t)elapsed_ms * policy.scan_permille;
+
+	key = k_spin_lock(&policy.lock);
+	policy.stats.elapsed_ms += elapsed_ms;
+	policy.stats.radio_us += radio;
+	policy.stats.radio_active_us += radio_active;
+	policy.stats.bulb_us += bulb;
+	policy.stats.bulb_active_us += bulb_active;
+	k_spin_unlock(&policy.lock, key);
+}
+
+// Percentage of time x 100 taken by us out of ms
+static uint32_t duty_x100(uint64_t us, uint64_t ms)
+{
+	return ms ? (uint32_t)((us * 10U) / ms) : 0;
+}
+
+static uint32_t saved_percent(uint64_t us, uint64_t active_us)
+{
+	return active_us > us ? (uint32_t)(100U - (us * 100U) / active_us) : 0;
+}
+
+static void changed_handler(struct k_work *work)
+{
+	policy.cb->changed(atomic_get(&policy.idle));
+}
+
+static void tick_handler(struct k_work *work)
+{
+	uint32_t quiet_ms = k_uptime_get_32() - (uint32_t)atomic_get(&policy.last_activity);
+	k_spinlock_key_t key;
+
+	if (IS_ENABLED(CONFIG_APP_IDLE_STATS)) {
+		account();
+	}
+
+	if (!atomic_get(&policy.idle) && quiet_ms >= CONFIG_APP_IDLE_AFTER_S * MSEC_PER_SEC &&
+	    link_count() && atomic_cas(&policy.idle, 0, 1)) {
+		LOG_INF("Nothing sent for %u s, %u link(s) idle", quiet_ms / MSEC_PER_SEC,
+			(unsigned int)link_count());
+
+		key = k_spin_lock(&policy.lock);
+		policy.stats.idle_entries++;
+		k_spin_unlock(&policy.lock, key);
+
+		mark_all_pending();
+		(void)k_work_submit_to_queue(policy.queue, &changed_work);
+	}
+
+	reconcile();
+
+	(void)k_work_schedule_for_queue(policy.queue, &tick_work,
+				       K_MSEC(CONFIG_APP_IDLE_PERIOD_MS));
+}
+
+static void wake_handler(struct k_work *work)
+{
+	struct idle_policy_stats s;
+	k_spinlock_key_t key;
+	uint32_t duty, active;
+
+	mark_all_pending();
+	reconcile();
+	policy.cb->changed(atomic_get(&policy.idle));
+
+	key = k_spin_lock(&policy.lock);
+	policy.stats.wakeups++;
+	s = policy.stats;
+	k_spin_unlock(&policy.lock, key);
+
+	if (!IS_ENABLED(CONFIG_APP_IDLE_STATS)) {
+		LOG_INF("Links active again");
+		return;
+	}
+
+	duty = duty_x100(s.radio_us, s.elapsed_ms);
+	active = duty_x100(s.radio_active_us, s.elapsed_ms);
+	LOG_INF("Links active again, radio duty since boot %u.%02u%% instead of %u.%02u%% (-%u%%)",
+		duty / 100U, duty % 100U, active / 100U, active % 100U,
+		saved_percent(s.radio_us, s.radio_active_us));
+}
+
+void idle_policy_activity(void)
+{
+	atomic_set(&policy.last_activity, k_uptime_get_32());
+
+	// Ahead of the next tick, the command that woke us should not wait for it
+	if (atomic_cas(&policy.idle, 1, 0)) {
+		(void)k_work_submit_to_queue(policy.queue, &wake_work);
+	}
+}
+
+void idle_policy_link_ready(struct bt_conn *conn)
+{
+	uint8_t index = bt_conn_index(conn);
+	struct bt_conn *old;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&policy.lock);
+	old = policy.links[index];
+	policy.links[index] = bt_conn_ref(conn);
+	k_spin_unlock(&policy.lock, key);
+
+	if (old) {
+		bt_conn_unref(old);
+	}
+
+	// Joined while idle: slowed down with the next tick
+	if (atomic_get(&policy.idle)) {
+		atomic_set_bit(&policy.pending, index);
+	}
+}
+
+bool idle_policy_idle(void)
+{
+	return atomic_get(&policy.idle);
+}
+
+void idle_policy_get_stats(struct idle_policy_stats *stats)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&policy.lock);
+	*stats = policy.stats;
+	k_spin_unlock(&policy.lock, key);
+}
+
+void idle_policy_init(struct k_work_q *queue, const struct idle_policy_cb *cb)
+{
+	policy.queue = queue;
+	policy.cb = cb;
+	policy.last_sample = k_uptime_get_32();
+	atomic_set(&policy.last_activity, policy.last_sample);
+
+	(void)k_work_schedule_for_queue(queue, &tick_work, K_MSEC(CONFIG_APP_IDLE_PERIOD_MS));
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	uint8_t index = bt_conn_index(conn);
+	bool removed = false;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&policy.lock);
+	if (policy.links[index] == conn) {
+		policy.links[index] = NULL;
+		atomic_clear_bit(&policy.pending, index);
+		removed = true;
+	}
+	k_spin_unlock(&policy.lock, key);
+
+	if (removed) {
+		bt_conn_unref(conn);
+	}
+}
+
+BT_CONN_CB_DEFINE(idle_policy_callbacks) = {
+	.disconnected = disconnected,
+};
+
+#if defined(CONFIG_SHELL)
+static int cmd_idle_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct idle_policy_stats s;
+	uint32_t duty, active;
+
+	idle_policy_get_stats(&s);
+
+	shell_print(sh, "%s, idle %u time(s), woken %u time(s), %u link(s)",
+		    idle_policy_idle() ? "idle" : "active", s.idle_entries, s.wakeups,
+		    (unsigned int)link_count());
+
+	if (!IS_ENABLED(CONFIG_APP_IDLE_STATS)) {
+		return 0;
+	}
+
+	duty = duty_x100(s.radio_us, s.elapsed_ms);
+	active = duty_x100(s.radio_active_us, s.elapsed_ms);
+	shell_print(sh, "central radio %u.%02u%%, %u.%02u%% at active parameters (-%u%%)",
+		    duty / 100U, duty % 100U, active / 100U, active % 100U,
+		    saved_percent(s.radio_us, s.radio_active_us));
+
+	duty = duty_x100(s.bulb_us, s.elapsed_ms);
+	active = duty_x100(s.bulb_active_us, s.elapsed_ms);
+	shell_print(sh, "bulb radio    %u.%02u%%, %u.%02u%% at active parameters (-%u%%)",
+		    duty / 100U, duty % 100U, active / 100U, active % 100U,
+		    saved_percent(s.bulb_us, s.bulb_active_us));
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(idle_cmds,
+	SHELL_CMD(stats, NULL, "Idle transitions and estimated radio duty cycle", cmd_idle_stats),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(idle, &idle_cmds, "Idle power policy", NULL);
+#endif /* CONFIG_SHELL */
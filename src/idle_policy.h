@@ -0,0 +1,48 @@
+/* idle_policy.h - Slow links down and park the scan while nothing is sent */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef IDLE_POLICY_H_
+#define IDLE_POLICY_H_
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+
+struct idle_policy_cb {
+	// Idle was entered or left. Runs on the queue given to idle_policy_init().
+	void (*changed)(bool idle);
+	// Share of radio time taken by the running scan in permille, 0 when not scanning
+	uint32_t (*scan_permille)(void);
+};
+
+struct idle_policy_stats {
+	uint32_t idle_entries;
+	uint32_t wakeups;
+	// The rest stays 0 without CONFIG_APP_IDLE_STATS. Time accounted since boot
+	uint64_t elapsed_ms;
+	// Estimated radio time of the central: connection events plus scan windows
+	uint64_t radio_us;
+	// The same had every link stayed on its active parameters and the scan never parked
+	uint64_t radio_active_us;
+	// Connection events the bulbs had to listen to, given their peripheral latency
+	uint64_t bulb_us;
+	uint64_t bulb_active_us;
+};
+
+void idle_policy_init(struct k_work_q *queue, const struct idle_policy_cb *cb);
+
+// conn is ready and follows the policy from now on, until it disconnects
+void idle_policy_link_ready(struct bt_conn *conn);
+
+// A command is about to be sent: back to the active parameters without waiting
+// for the next tick. Only queues the switch, safe from any thread.
+void idle_policy_activity(void);
+
+bool idle_policy_idle(void);
+
+void idle_policy_get_stats(struct idle_policy_stats *stats);
+
+#endif /* IDLE_POLICY_H_ */
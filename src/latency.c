@@ -0,0 +1,270 @@
+/* latency.c - Per-connection bring-up latency instrumentation */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#include "latency.h"
+
+// log2(us) buckets: bucket n holds [2^n, 2^(n+1)) us, the last one everything above
+#define LATENCY_HIST_BUCKETS 24
+
+// A scan hit older than this is not attributed to the next connection
+#define SCAN_HIT_MAX_AGE_MS 2000
+
+typedef struct {
+	uint32_t cycles[LATENCY_STAGE_COUNT];
+	// Coarse copy, used when the cycle counter may have wrapped in between
+	uint32_t ms[LATENCY_STAGE_COUNT];
+	uint32_t marked;
+	bool done;
+
+} latency_trace_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint64_t sum_us;
+	uint32_t hist[LATENCY_HIST_BUCKETS];
+
+} latency_stat_t;
+
+static const char *const stage_names[LATENCY_STAGE_COUNT] = {
+	[LATENCY_SCAN_HIT] = "scan hit",
+	[LATENCY_CONN_CREATE] = "conn create",
+	[LATENCY_CONNECTED] = "connected",
+	[LATENCY_REMOTE_INFO] = "remote info",
+	[LATENCY_DB_HASH] = "db hash",
+	[LATENCY_CHRC_SWEEP] = "chrc sweep",
+	[LATENCY_CCC_DISCOVERY] = "ccc discovery",
+	[LATENCY_SUBSCRIBED] = "subscribed",
+	[LATENCY_FIRST_WRITE] = "first write",
+};
+
+// Indexed by connection slot
+static latency_trace_t traces[CONFIG_BT_MAX_CONN];
+
+// stats[stage]: time since the previous stage the link went through,
+// stats[LATENCY_STAGE_COUNT]: first stage to first write
+static latency_stat_t stats[LATENCY_STAGE_COUNT + 1];
+
+static struct {
+	bool valid;
+	uint32_t cycles;
+	uint32_t ms;
+} pending_scan_hit;
+
+static struct k_spinlock lock;
+
+static uint32_t delta_us(const latency_trace_t *t, enum latency_stage from, enum latency_stage to)
+{
+	uint32_t ms = t->ms[to] - t->ms[from];
+	uint32_t wrap_ms = (uint32_t)(((uint64_t)UINT32_MAX * 1000U) / sys_clock_hw_cycles_per_sec());
+
+	// Stay clear of the cycle counter wrapping, ms resolution is plenty there
+	if (ms >= wrap_ms / 2) {
+		return ms > UINT32_MAX / 1000U ? UINT32_MAX : ms * 1000U;
+	}
+
+	return k_cyc_to_us_floor32(t->cycles[to] - t->cycles[from]);
+}
+
+static void stat_add(latency_stat_t *stat, uint32_t us)
+{
+	int bucket = us ? 31 - __builtin_clz(us) : 0;
+
+	stat->min_us = stat->count ? MIN(stat->min_us, us) : us;
+	stat->max_us = MAX(stat->max_us, us);
+	stat->sum_us += us;
+	stat->count++;
+	stat->hist[MIN(bucket, LATENCY_HIST_BUCKETS - 1)]++;
+}
+
+static void trace_commit(const latency_trace_t *t)
+{
+	int prev = -1;
+	int first = -1;
+
+	for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+		if (!(t->marked & BIT(stage))) {
+			continue;
+		}
+
+		if (prev >= 0) {
+			stat_add(&stats[stage], delta_us(t, prev, stage));
+		} else {
+			first = stage;
+		}
+
+		prev = stage;
+	}
+
+	if (first >= 0 && first != LATENCY_FIRST_WRITE) {
+		stat_add(&stats[LATENCY_STAGE_COUNT], delta_us(t, first, LATENCY_FIRST_WRITE));
+	}
+}
+
+void latency_scan_hit(void)
+{
+	uint32_t now_ms = k_uptime_get_32();
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&lock);
+
+	// Keep the first hit, the candidate window until the connection is part of the cost
+	if (!pending_scan_hit.valid || (now_ms - pending_scan_hit.ms) > SCAN_HIT_MAX_AGE_MS) {
+		pending_scan_hit.valid = true;
+		pending_scan_hit.cycles = k_cycle_get_32();
+		pending_scan_hit.ms = now_ms;
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+void latency_start(int slot, bool from_scan)
+{
+	latency_trace_t *t = &traces[slot];
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&lock);
+
+	(void)memset(t, 0, sizeof(*t));
+
+	if (from_scan && pending_scan_hit.valid &&
+	    (k_uptime_get_32() - pending_scan_hit.ms) <= SCAN_HIT_MAX_AGE_MS) {
+		t->cycles[LATENCY_SCAN_HIT] = pending_scan_hit.cycles;
+		t->ms[LATENCY_SCAN_HIT] = pending_scan_hit.ms;
+		t->marked |= BIT(LATENCY_SCAN_HIT);
+	}
+	pending_scan_hit.valid = false;
+
+	k_spin_unlock(&lock, key);
+
+	latency_mark(slot, LATENCY_CONN_CREATE);
+}
+
+void latency_mark_at(int slot, enum latency_stage stage, uint32_t cycles)
+{
+	latency_trace_t *t = &traces[slot];
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&lock);
+
+	if (t->done || (t->marked & BIT(stage))) {
+		k_spin_unlock(&lock, key);
+		return;
+	}
+
+	t->cycles[stage] = cycles;
+	t->ms[stage] = k_uptime_get_32();
+	t->marked |= BIT(stage);
+
+	if (stage == LATENCY_FIRST_WRITE) {
+		t->done = true;
+		trace_commit(t);
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+void latency_mark(int slot, enum latency_stage stage)
+{
+	latency_mark_at(slot, stage, k_cycle_get_32());
+}
+
+#if defined(CONFIG_SHELL)
+static void print_us(const struct shell *sh, const char *label, const latency_stat_t *stat)
+{
+	uint32_t avg = (uint32_t)(stat->sum_us / stat->count);
+
+	shell_print(sh, "%-14s n=%-5u min %u.%03u avg %u.%03u max %u.%03u ms", label, stat->count,
+		    stat->min_us / 1000U, stat->min_us % 1000U, avg / 1000U, avg % 1000U,
+		    stat->max_us / 1000U, stat->max_us % 1000U);
+}
+
+static int cmd_latency_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	latency_stat_t stat;
+	k_spinlock_key_t key;
+
+	for (size_t i = 0; i < ARRAY_SIZE(stats); i++) {
+		key = k_spin_lock(&lock);
+		stat = stats[i];
+		k_spin_unlock(&lock, key);
+
+		if (!stat.count) {
+			continue;
+		}
+
+		print_us(sh, i < LATENCY_STAGE_COUNT ? stage_names[i] : "total", &stat);
+
+		for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+			if (stat.hist[b]) {
+				shell_print(sh, "  %s%u us: %u", b == LATENCY_HIST_BUCKETS - 1 ? ">=" : "~",
+					    1U << b, stat.hist[b]);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_latency_conn(const struct shell *sh, size_t argc, char **argv)
+{
+	latency_trace_t t;
+	k_spinlock_key_t key;
+	int first;
+
+	for (size_t slot = 0; slot < ARRAY_SIZE(traces); slot++) {
+		key = k_spin_lock(&lock);
+		t = traces[slot];
+		k_spin_unlock(&lock, key);
+
+		if (!t.marked) {
+			continue;
+		}
+
+		shell_print(sh, "Slot %u%s", (unsigned int)slot, t.done ? "" : " (in progress)");
+
+		first = __builtin_ctz(t.marked);
+		for (int stage = first; stage < LATENCY_STAGE_COUNT; stage++) {
+			uint32_t us;
+
+			if (!(t.marked & BIT(stage))) {
+				continue;
+			}
+
+			us = delta_us(&t, first, stage);
+			shell_print(sh, "  %-14s +%u.%03u ms", stage_names[stage], us / 1000U, us % 1000U);
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_latency_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&lock);
+	(void)memset(stats, 0, sizeof(stats));
+	k_spin_unlock(&lock, key);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(latency_cmds,
+	SHELL_CMD(stats, NULL, "Per stage latency statistics and histograms", cmd_latency_stats),
+	SHELL_CMD(conn, NULL, "Bring-up timeline of every connection slot", cmd_latency_conn),
+	SHELL_CMD(reset, NULL, "Clear the statistics", cmd_latency_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(latency, &latency_cmds, "Bring-up latency instrumentation", NULL);
+#endif /* CONFIG_SHELL */
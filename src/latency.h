@@ -0,0 +1,51 @@
+/* latency.h - Per-connection bring-up latency instrumentation */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <zephyr/types.h>
+
+// Bring-up stages in the order they normally happen. Stages a link skips
+// (e.g. the discovery sweep when the handle cache hits) are simply not set.
+enum latency_stage {
+	LATENCY_SCAN_HIT,
+	LATENCY_CONN_CREATE,
+	LATENCY_CONNECTED,
+	LATENCY_REMOTE_INFO,
+	LATENCY_DB_HASH,
+	LATENCY_CHRC_SWEEP,
+	LATENCY_CCC_DISCOVERY,
+	LATENCY_SUBSCRIBED,
+	LATENCY_FIRST_WRITE,
+	LATENCY_STAGE_COUNT
+};
+
+#if defined(CONFIG_APP_LATENCY)
+
+// A matching advertisement was seen. Kept until the next latency_start().
+void latency_scan_hit(void);
+
+// A connection is being created on slot. from_scan hands over the pending
+// scan hit, otherwise the trace starts at the connection creation.
+void latency_start(int slot, bool from_scan);
+
+// Timestamp stage on slot now, or at cycles (a k_cycle_get_32() value).
+// Only the first mark of a stage counts. LATENCY_FIRST_WRITE completes the
+// trace and folds it into the per-stage statistics.
+void latency_mark(int slot, enum latency_stage stage);
+void latency_mark_at(int slot, enum latency_stage stage, uint32_t cycles);
+
+#else
+
+static inline void latency_scan_hit(void) {}
+static inline void latency_start(int slot, bool from_scan) {}
+static inline void latency_mark(int slot, enum latency_stage stage) {}
+static inline void latency_mark_at(int slot, enum latency_stage stage, uint32_t cycles) {}
+
+#endif /* CONFIG_APP_LATENCY */
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,257 @@
+/* link_tuning.c - PHY / data length / MTU / connection parameter negotiation */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "link_tuning.h"
+
+LOG_MODULE_REGISTER(link_tuning, CONFIG_APP_LINK_TUNING_LOG_LEVEL);
+
+typedef enum {
+	LINK_STEP_IDLE,
+	LINK_STEP_PHY,
+	LINK_STEP_DATA_LEN,
+	LINK_STEP_MTU,
+	LINK_STEP_CONN_PARAM,
+	LINK_STEP_DONE,
+} link_step_t;
+
+static const char *const step_names[] = {
+	[LINK_STEP_IDLE] = "idle",
+	[LINK_STEP_PHY] = "PHY",
+	[LINK_STEP_DATA_LEN] = "data length",
+	[LINK_STEP_MTU] = "ATT MTU",
+	[LINK_STEP_CONN_PARAM] = "connection parameters",
+	[LINK_STEP_DONE] = "done",
+};
+
+typedef struct {
+	struct bt_conn *conn;
+	link_tuning_done_t done;
+	link_step_t step;
+	// Set from the BT callbacks when the current step got its answer
+	bool step_answered;
+	bool peer_2m;
+	bool peer_coded;
+	bool peer_dle;
+	int8_t rssi;
+	struct bt_gatt_exchange_params mtu_params;
+	struct k_work_delayable step_work;
+
+} link_tuning_t;
+
+// Indexed by bt_conn_index()
+static link_tuning_t links[CONFIG_BT_MAX_CONN];
+
+static const struct bt_le_conn_param preferred_param =
+	BT_LE_CONN_PARAM_INIT(CONFIG_APP_LINK_INTERVAL_MIN, CONFIG_APP_LINK_INTERVAL_MAX,
+			      CONFIG_APP_LINK_LATENCY, CONFIG_APP_LINK_TIMEOUT);
+
+static link_tuning_t *link_get(struct bt_conn *conn)
+{
+	link_tuning_t *lt = &links[bt_conn_index(conn)];
+
+	return lt->conn == conn ? lt : NULL;
+}
+
+static void step_answered(struct bt_conn *conn, link_step_t step)
+{
+	link_tuning_t *lt = link_get(conn);
+
+	if (!lt || lt->step != step) {
+		return;
+	}
+
+	lt->step_answered = true;
+	k_work_reschedule(&lt->step_work, K_NO_WAIT);
+}
+
+static void mtu_exchange_func(struct bt_conn *conn, uint8_t err,
+			      struct bt_gatt_exchange_params *params)
+{
+	// A rejected exchange is an answer too, keep the default MTU
+	if (err) {
+		LOG_WRN("MTU exchange failed (err 0x%02x)", err);
+	}
+
+	step_answered(conn, LINK_STEP_MTU);
+}
+
+// Issue the request for lt->step. Returns 0 if we now wait for an answer.
+static int step_request(link_tuning_t *lt)
+{
+	switch (lt->step) {
+	case LINK_STEP_PHY:
+		// Far bulbs trade throughput for range, near ones get the shortest events
+		if (IS_ENABLED(CONFIG_APP_LINK_CODED) && lt->peer_coded &&
+		    lt->rssi != BT_HCI_LE_RSSI_NOT_AVAILABLE && lt->rssi < CONFIG_APP_LINK_CODED_RSSI) {
+			return bt_conn_le_phy_update(lt->conn, BT_CONN_LE_PHY_PARAM_CODED);
+		}
+		if (!IS_ENABLED(CONFIG_APP_LINK_PREFER_2M) || !lt->peer_2m) {
+			return -ENOTSUP;
+		}
+		return bt_conn_le_phy_update(lt->conn, BT_CONN_LE_PHY_PARAM_2M);
+
+	case LINK_STEP_DATA_LEN:
+		if (!IS_ENABLED(CONFIG_APP_LINK_DATA_LEN) || !lt->peer_dle) {
+			return -ENOTSUP;
+		}
+		return bt_conn_le_data_len_update(lt->conn, BT_LE_DATA_LEN_PARAM_MAX);
+
+	case LINK_STEP_MTU:
+		if (!IS_ENABLED(CONFIG_APP_LINK_MTU)) {
+			return -ENOTSUP;
+		}
+		lt->mtu_params.func = mtu_exchange_func;
+		return bt_gatt_exchange_mtu(lt->conn, &lt->mtu_params);
+
+	case LINK_STEP_CONN_PARAM:
+		return bt_conn_le_param_update(lt->conn, &preferred_param);
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static void step_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	link_tuning_t *lt = CONTAINER_OF(dwork, link_tuning_t, step_work);
+	int err;
+
+	if (!lt->conn) {
+		return;
+	}
+
+	// Either the answer arrived or the peer stayed silent; move on regardless
+	if (lt->step != LINK_STEP_IDLE && !lt->step_answered) {
+		LOG_WRN("No answer for %s, skipping", step_names[lt->step]);
+	}
+
+	while (++lt->step < LINK_STEP_DONE) {
+		lt->step_answered = false;
+
+		err = step_request(lt);
+		if (!err) {
+			k_work_schedule(&lt->step_work, K_MSEC(CONFIG_APP_LINK_STEP_TIMEOUT_MS));
+			return;
+		}
+
+		// -EALREADY: e.g. the MTU was already exchanged on this link
+		if (err != -ENOTSUP && err != -EALREADY) {
+			LOG_WRN("%s request failed (err %d)", step_names[lt->step], err);
+		}
+	}
+
+	link_tuning_print(lt->conn);
+
+	if (lt->done) {
+		lt->done(lt->conn);
+	}
+}
+
+void link_tuning_init(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(links); i++) {
+		k_work_init_delayable(&links[i].step_work, step_work_handler);
+	}
+}
+
+int link_tuning_start(struct bt_conn *conn, int8_t rssi, link_tuning_done_t done)
+{
+	link_tuning_t *lt = &links[bt_conn_index(conn)];
+	struct bt_conn_remote_info remote_info;
+	struct k_work_sync sync;
+	int err;
+
+	err = bt_conn_get_remote_info(conn, &remote_info);
+	if (err) {
+		return err;
+	}
+
+	// Restarting on the same link, or a step of the previous one still running
+	(void)k_work_cancel_delayable_sync(&lt->step_work, &sync);
+
+	lt->conn = conn;
+	lt->done = done;
+	lt->step = LINK_STEP_IDLE;
+	lt->step_answered = true;
+	lt->rssi = rssi;
+	lt->peer_2m = BT_FEAT_LE_PHY_2M(remote_info.le.features);
+	lt->peer_coded = BT_FEAT_LE_PHY_CODED(remote_info.le.features);
+	lt->peer_dle = BT_FEAT_LE_DLE(remote_info.le.features);
+
+	k_work_schedule(&lt->step_work, K_NO_WAIT);
+
+	return 0;
+}
+
+void link_tuning_print(struct bt_conn *conn)
+{
+	struct bt_conn_info info;
+	uint32_t interval_us;
+
+	if (bt_conn_get_info(conn, &info)) {
+		return;
+	}
+
+	interval_us = info.le.interval * 1250U;
+
+	LOG_INF("Link %u: interval %u.%02u ms, latency %u, timeout %u ms, "
+	       "PHY tx %u rx %u, data length tx %u rx %u, MTU %u",
+	       bt_conn_index(conn), interval_us / 1000U, (interval_us % 1000U) / 10U,
+	       info.le.latency, info.le.timeout * 10U,
+	       info.le.phy->tx_phy, info.le.phy->rx_phy,
+	       info.le.data_len->tx_max_len, info.le.data_len->rx_max_len,
+	       bt_gatt_get_mtu(conn));
+}
+
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+	step_answered(conn, LINK_STEP_PHY);
+}
+
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info)
+{
+	step_answered(conn, LINK_STEP_DATA_LEN);
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+			     uint16_t latency, uint16_t timeout)
+{
+	step_answered(conn, LINK_STEP_CONN_PARAM);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	link_tuning_t *lt = link_get(conn);
+	struct k_work_sync sync;
+
+	if (!lt) {
+		return;
+	}
+
+	// The connection may go away once this returns: wait for a step still
+	// running with it, only then forget it. Answers come from this thread too.
+	(void)k_work_cancel_delayable_sync(&lt->step_work, &sync);
+	lt->conn = NULL;
+}
+
+BT_CONN_CB_DEFINE(link_tuning_callbacks) = {
+	.disconnected = disconnected,
+	.le_param_updated = le_param_updated,
+	.le_phy_updated = le_phy_updated,
+	.le_data_len_updated = le_data_len_updated,
+};
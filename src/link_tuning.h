@@ -0,0 +1,30 @@
+/* link_tuning.h - PHY / data length / MTU / connection parameter negotiation */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LINK_TUNING_H_
+#define LINK_TUNING_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/conn.h>
+
+typedef void (*link_tuning_done_t)(struct bt_conn *conn);
+
+// Once, before the first connection
+void link_tuning_init(void);
+
+// Run the configured tuning sequence on a connected link: 2M PHY (Coded PHY
+// when rssi is below CONFIG_APP_LINK_CODED_RSSI), data length extension,
+// ATT MTU exchange and the preferred connection parameters. Steps the peer
+// does not support, rejects, or does not answer within
+// CONFIG_APP_LINK_STEP_TIMEOUT_MS are skipped. rssi is the last one seen
+// while scanning, BT_HCI_LE_RSSI_NOT_AVAILABLE if unknown. Requires the
+// remote features, so call it from (or after) remote_info_available.
+int link_tuning_start(struct bt_conn *conn, int8_t rssi, link_tuning_done_t done);
+
+// Print the current PHY, data length, MTU and connection parameters
+void link_tuning_print(struct bt_conn *conn);
+
+#endif /* LINK_TUNING_H_ */
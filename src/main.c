@@ -10,7 +10,7 @@
 #include <stddef.h>
 #include <errno.h>
 #include <zephyr/kernel.h>
-#include <zephyr/sys/printk.h>
+#include <zephyr/logging/log.h>
 
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/hci.h>
@@ -18,19 +18,37 @@
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
 #include <zephyr/sys/byteorder.h>
+#include <zephyr/settings/settings.h>
 
 #include <dk_buttons_and_leds.h>
 
-// Important defines
-#define NAME_LEN      30
-#define PERIPHERAL_NAME "PLAYBULB CANDLE II"
-
-// Color Settings
+#include "gatt_cache.h"
+#include "gatt_discovery.h"
+#include "color.h"
+#include "color_queue.h"
+#include "color_sync.h"
+#include "link_tuning.h"
+#include "fleet.h"
+#include "adv_match.h"
+#include "bulb_profile.h"
+#include "scan_cache.h"
+#include "scan_duty.h"
+#include "latency.h"
+#include "bench.h"
+#include "notify_ring.h"
+#include "state_sync.h"
+#include "animation.h"
+#include "host_cmd.h"
+#include "idle_policy.h"
+#include "battery_log.h"
+#include "gatt_sched.h"
+#include "central_stats.h"
+#include "recovery.h"
+
+LOG_MODULE_REGISTER(central, CONFIG_APP_CENTRAL_LOG_LEVEL);
+
+// Color Settings, converted to each bulb's wire format by its profile
 #define COLOR_COUNT 4
-#define COLOR_WHITE 0x000000FF
-#define COLOR_RED   0x0000FF00
-#define COLOR_GREEN 0x00FF0000
-#define COLOR_BLUE  0xFF000000
 
 #define COLOR_STRING_MAX_LENGTH 6
 
@@ -47,11 +65,33 @@ static color_setting_t color_array[COLOR_COUNT] =
 	{COLOR_GREEN, "Green"},
 	{COLOR_BLUE, "Blue"} };
 
-#define BT_UUID_COLOR_SETTING BT_UUID_DECLARE_16(0xFFFC)
-
-// Button Action Assignments
+// Longest advertised name printed in scan reports
+#define SCAN_LOG_NAME_MAX 30
+
+// Connection interval units are 1.25 ms, printed as ms with two decimals
+#define INTERVAL_MS_FMT "%u.%02u ms"
+#define INTERVAL_MS_ARGS(_interval) \
+	((_interval) * 125U) / 100U, ((_interval) * 125U) % 100U
+// Scan interval and window units are 0.625 ms, same format
+#define SCAN_MS_ARGS(_units) \
+	((_units) * 625U) / 1000U, (((_units) * 625U) % 1000U) / 10U
+
+// Scanning and initiating cover the Coded PHY too when it is enabled,
+// bulbs out of 1M range are only heard there
+#define SCAN_OPT_CODED (IS_ENABLED(CONFIG_APP_SCAN_CODED) ? BT_LE_SCAN_OPT_CODED : 0)
+#define CONN_CREATE_OPTIONS \
+	(IS_ENABLED(CONFIG_APP_SCAN_CODED) ? BT_CONN_LE_OPT_CODED : BT_CONN_LE_OPT_NONE)
+
+// Passive scan that only reports fleet members from the filter accept list
+#define SCAN_PARAM_ACCEPT_LIST \
+	BT_LE_SCAN_PARAM(BT_LE_SCAN_TYPE_PASSIVE, \
+			 BT_LE_SCAN_OPT_FILTER_ACCEPT_LIST | BT_LE_SCAN_OPT_FILTER_DUPLICATE | \
+			 SCAN_OPT_CODED, \
+			 BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW)
+
+// Button Action Assignments (applied to every connected bulb)
 // - Button 1 ==> Rotate Colors
-// - Button 2 ==> Read Battery Level
+// - Button 2 ==> Read Colour and Battery Level
 // - Button 3 ==> Update Connection Parameters
 // - Button 4 ==> Disconnect from device
 #define BUTTON_COLOR         DK_BTN1_MSK
@@ -60,434 +100,2094 @@ static color_setting_t color_array[COLOR_COUNT] =
 #define BUTTON_DISCONNECT    DK_BTN4_MSK
 
 // Data Types
-typedef struct adv_data
-{
-    // Device Name
-	uint8_t length;
-    char name[NAME_LEN];
-
-} custom_adv_data_t;
+typedef enum {
+	BULB_STATE_FREE,
+	BULB_STATE_CONNECTING,
+	BULB_STATE_RECONNECTING,
+	BULB_STATE_CONNECTED,
+	BULB_STATE_DISCOVERING,
+	BULB_STATE_READY,
+	BULB_STATE_DISCONNECTING,
+	BULB_STATE_COUNT
+} bulb_state_t;
+
+// Inputs of the connection state machine, posted from the BT callbacks
+typedef enum {
+	BULB_EVT_CONNECTED,
+	BULB_EVT_CONNECT_FAILED,
+	BULB_EVT_REMOTE_INFO,
+	BULB_EVT_DISCOVERED,
+	BULB_EVT_DISCOVERY_FAILED,
+	BULB_EVT_RETRY,
+	BULB_EVT_TIMEOUT,
+	BULB_EVT_DISCONNECT,
+	BULB_EVT_DISCONNECTED,
+	BULB_EVT_COUNT
+} bulb_event_t;
+
+// Bring-up step repeated by BULB_EVT_RETRY
+typedef enum {
+	BULB_RETRY_CONNECT,
+	// Database Hash read or discovery, through the GATT scheduler
+	BULB_RETRY_SETUP,
+	BULB_RETRY_DISCOVERY,
+	BULB_RETRY_SUBSCRIBE,
+	BULB_RETRY_COUNT
+} bulb_retry_t;
+
+static const char *const bulb_retry_names[BULB_RETRY_COUNT] = {
+	[BULB_RETRY_CONNECT] = "connection",
+	[BULB_RETRY_SETUP] = "setup",
+	[BULB_RETRY_DISCOVERY] = "discovery",
+	[BULB_RETRY_SUBSCRIBE] = "subscription",
+};
 
-// Semaphores
-static K_SEM_DEFINE(sem_connected, 0, 1);
-static K_SEM_DEFINE(sem_discovered, 0, 1);
-static K_SEM_DEFINE(sem_written, 0, 1);
-static K_SEM_DEFINE(sem_read_operation, 0, 1);
-static K_SEM_DEFINE(sem_disconnected, 0, 1);
+// Per-connection state, one entry per bulb link
+typedef struct {
+	// State machine plumbing, initialised once and kept across bulb_alloc()
+	struct k_work sm_work;
+	struct k_work_delayable timeout_work;
+	// Backoff of the step being retried, posts BULB_EVT_RETRY
+	struct recovery recovery;
+	atomic_t events;
+	bulb_state_t state;
+
+	// Everything from here on describes the current link and is reset with it
+	struct bt_conn *conn;
+
+	// Model of the bulb, picked from its advertisement or the fleet registry
+	const struct bulb_profile *profile;
+	// Averaged scan RSSI when the connection was initiated, picks the PHY
+	int8_t rssi;
+
+	// Uptime at which a working link was lost, 0 unless a fast reconnect is under way
+	int64_t link_lost_at;
+	// k_uptime_get_32() when the connection was initiated on a scan match (0 for
+	// an auto-connect) and when it came up, for the benchmark baselines
+	uint32_t connect_start_ms;
+	uint32_t connected_ms;
+
+	// HCI error of the failed connection attempt
+	uint8_t connect_err;
+	bulb_retry_t retry_step;
+	// Where a scheduled connection retry goes, BT_ADDR_LE_ANY once it ran
+	bt_addr_le_t retry_addr;
+
+	uint16_t color_attr_handle;
+	uint16_t battery_level_value_handle;
+
+	struct gatt_discovery discovery;
+	struct gatt_discovery_result discovery_results[BULB_CHRC_COUNT];
+	int discovery_err;
+	struct bt_gatt_subscribe_params subscribe_params;
+	struct bt_gatt_read_params read_params;
+	// Database Hash read, discovery and their retries wait for the scheduler,
+	// holding one slot until discovery_complete() or a retry backs off
+	struct gatt_sched_op setup_op;
+	bool setup_slot;
+
+	// GATT caching: Database Hash read at the start of discovery
+	bool has_db_hash;
+	bool handles_from_cache;
+	uint8_t db_hash[GATT_DB_HASH_LEN];
+
+	// Colour frames are written through this queue once the bulb is ready
+	struct color_queue color_queue;
+	// Receive time of a host colour command not confirmed on air yet, 0 if none.
+	// Set on bulb_workq, taken by the write completion in the BT context.
+	atomic_t host_cmd_cycles;
+
+	// Current colour and battery level, read back together (button 2)
+	struct state_sync state_sync;
+	struct state_sync_value state_values[BULB_CHRC_COUNT];
+
+	// Battery levels go to the series of fleet member battery_series
+	bool battery_logged;
+	uint8_t battery_series;
+} bulb_conn_t;
+
+// Every link is driven from this work queue, no thread blocks on a single bulb
+static K_THREAD_STACK_DEFINE(bulb_workq_stack, CONFIG_APP_CONN_SM_STACK_SIZE);
+static struct k_work_q bulb_workq;
 
 // Important global variables
-static uint16_t color_attr_handle;
-static uint16_t battery_level_value_handle;
 static uint32_t current_color_index = 0; // Start with White (at index 0)
-static struct bt_conn *default_conn;
+static bulb_conn_t conn_table[CONFIG_BT_MAX_CONN];
+
+// Link loss to ready again, for links recovered by a fast reconnect
+static struct {
+	uint32_t restored;
+	uint32_t fallbacks;
+	uint32_t last_ms;
+	uint32_t min_ms;
+	uint32_t max_ms;
+	uint64_t total_ms;
+} reconnect_stats;
+
+// Serialises scan control, connection start and the state machine steps
+// between the BT RX thread, bulb_workq and main, so that only one
+// connection is ever initiated. A mutex rather than a spinlock, the
+// Bluetooth calls made with it held block. It nests, start_scan() is also
+// called with it held.
+static K_MUTEX_DEFINE(scan_lock);
+
+// The scan state below is only changed with scan_lock held
+// The controller is connecting to any bulb on the filter accept list
+static bool auto_connecting;
+// The running scan only reports bulbs on the filter accept list
+static bool scan_accept_list;
+// A name based scan started by start_scan() is running at scan_level
+static bool scan_running;
+static enum scan_duty_level scan_level;
+// Every bulb of a fixed size fleet got ready once since boot
+static bool fleet_up;
 
-static struct bt_uuid_16 discover_uuid = BT_UUID_INIT_16(0);
-static struct bt_gatt_discover_params discover_params;
-static struct bt_gatt_subscribe_params subscribe_params;
-static struct bt_gatt_read_params read_params;
 
 // Function prototypes
 static void start_scan(void);
-static int toggle_color(void);
+static int stop_scan(void);
+static int toggle_color(bulb_conn_t *bulb);
+static void set_color_all(void);
+static void color_written(struct color_queue *q);
 
 // Functions
 
-static bool data_cb(struct bt_data *data, void *user_data)
+static int bulb_index(const bulb_conn_t *bulb)
+{
+	return bulb - conn_table;
+}
+
+static bulb_conn_t *bulb_find(const struct bt_conn *conn)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		if (conn_table[i].state != BULB_STATE_FREE && conn_table[i].conn == conn) {
+			return &conn_table[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void bulb_reset_link(bulb_conn_t *bulb)
+{
+	// Not left on a scheduler queue by the memset
+	gatt_sched_cancel(&bulb->setup_op);
+	gatt_sched_cancel(&bulb->color_queue.op);
+	gatt_sched_cancel(&bulb->state_sync.op);
+	recovery_reset(&bulb->recovery);
+
+	(void)memset((uint8_t *)bulb + offsetof(bulb_conn_t, conn), 0,
+		     sizeof(*bulb) - offsetof(bulb_conn_t, conn));
+	color_queue_init(&bulb->color_queue, NULL, 0, NULL);
+	state_sync_init(&bulb->state_sync);
+}
+
+static bulb_conn_t *bulb_alloc(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		bulb_conn_t *bulb = &conn_table[i];
+
+		if (bulb->state == BULB_STATE_FREE) {
+			// Events left over from the previous link are dropped with the
+			// rest, after the retry that could post one more
+			recovery_reset(&bulb->recovery);
+			(void)atomic_clear(&bulb->events);
+			bulb_reset_link(bulb);
+			return bulb;
+		}
+	}
+
+	return NULL;
+}
+
+static void bulb_free(bulb_conn_t *bulb)
+{
+	if (bulb->conn) {
+		bt_conn_unref(bulb->conn);
+		bulb->conn = NULL;
+	}
+
+	bulb->state = BULB_STATE_FREE;
+}
+
+static void bulb_post(bulb_conn_t *bulb, bulb_event_t evt)
+{
+	atomic_set_bit(&bulb->events, evt);
+	(void)k_work_submit_to_queue(&bulb_workq, &bulb->sm_work);
+}
+
+static bool bulb_connecting(void)
 {
-    custom_adv_data_t *adv_data_struct = user_data;
-    uint8_t len;
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		if (conn_table[i].state == BULB_STATE_CONNECTING ||
+		    conn_table[i].state == BULB_STATE_RECONNECTING) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static size_t bulbs_ready(void)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		count += conn_table[i].state == BULB_STATE_READY;
+	}
 
-    switch (data->type) {
-    case BT_DATA_NAME_SHORTENED:
-    case BT_DATA_NAME_COMPLETE:
-        len = MIN(data->data_len, NAME_LEN - 1);
-        memcpy(adv_data_struct->name, data->data, len);
-        adv_data_struct->name[len] = '\0';
-		adv_data_struct->length = len;
-        return false;
-    default:
-        return true;
-    }
+	return count;
 }
 
-static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
-			 struct net_buf_simple *ad)
+static bool bulb_slot_available(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		if (conn_table[i].state == BULB_STATE_FREE) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// With scan_lock held
+static void connect_bulb_locked(const bt_addr_le_t *addr, const struct bulb_profile *profile,
+				int8_t rssi)
 {
 	char addr_str[BT_ADDR_LE_STR_LEN];
-	custom_adv_data_t device_ad_data;
+	struct bt_conn *existing;
+	bulb_conn_t *bulb;
 	int err;
 
-	if (default_conn) {
+	// Only one connection can be initiated at a time
+	if (bulb_connecting()) {
 		return;
 	}
 
-	if (type != BT_GAP_ADV_TYPE_ADV_IND && type != BT_GAP_ADV_TYPE_SCAN_RSP)
-	{
+	// Skip bulbs we are already connected to
+	existing = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+	if (existing) {
+		bt_conn_unref(existing);
+		return;
+	}
+
+	bulb = bulb_alloc();
+	if (!bulb) {
 		return;
 	}
 
-    (void)memset(&device_ad_data, 0, sizeof(custom_adv_data_t));
-    bt_data_parse(ad, data_cb, &device_ad_data);
+	// The scan keeps collecting candidates while the controller connects, if it can
+	if (!IS_ENABLED(CONFIG_BT_SCAN_AND_INITIATE_IN_PARALLEL)) {
+		err = stop_scan();
+		if (err && err != -EALREADY) {
+			return;
+		}
+	}
 
-	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
+	bulb->state = BULB_STATE_CONNECTING;
+	bulb->profile = profile;
+	bulb->rssi = rssi;
+	bulb->connect_start_ms = k_uptime_get_32();
+	latency_start(bulb_index(bulb), true);
 
-	// Only log and care about devices with a non-empty device name
-	if (device_ad_data.length == 0)
-	{
+	err = bt_conn_le_create(addr,
+				BT_CONN_LE_CREATE_PARAM(CONN_CREATE_OPTIONS, BT_GAP_SCAN_FAST_INTERVAL,
+							BT_GAP_SCAN_FAST_INTERVAL),
+					BT_LE_CONN_PARAM_DEFAULT, &bulb->conn);
+	if (err) {
+		bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
+		LOG_ERR("Create conn to %s failed (%d)", addr_str, err);
+		bulb_free(bulb);
+		start_scan();
+	}
+}
+
+static void connect_bulb(const bt_addr_le_t *addr, const struct bulb_profile *profile,
+			 int8_t rssi)
+{
+	(void)k_mutex_lock(&scan_lock, K_FOREVER);
+	connect_bulb_locked(addr, profile, rssi);
+	(void)k_mutex_unlock(&scan_lock);
+}
+
+// Connect to the strongest bulb heard during the candidate window
+static void candidate_work_handler(struct k_work *work)
+{
+	struct scan_cache_entry best;
+	char addr_str[BT_ADDR_LE_STR_LEN];
+
+	if (bulb_connecting() || !scan_cache_best_candidate(CONFIG_APP_SCAN_CANDIDATE_WINDOW_MS, &best)) {
 		return;
 	}
 
-	printk("Device found [%s]: %s with name [%d]: |%s| (RSSI %d)\n", 
-			type == BT_GAP_ADV_TYPE_SCAN_RSP ? "Scan Response":"Regular Advertisement",
-			addr_str,
-			device_ad_data.length,
-			device_ad_data.name,
-			rssi);
+	bt_addr_le_to_str(&best.addr, addr_str, sizeof(addr_str));
+	LOG_INF("Best candidate %s (RSSI min %d avg %d max %d over %u reports)",
+	       addr_str, best.rssi_min, scan_cache_rssi_avg(&best), best.rssi_max,
+	       best.rssi_count);
+
+	connect_bulb(&best.addr, bulb_profile_get(best.profile), scan_cache_rssi_avg(&best));
+}
+
+static K_WORK_DELAYABLE_DEFINE(candidate_work, candidate_work_handler);
+
+// Bring-up pipeline: the moment a link is up, connect to the next bulb
+// already heard instead of scanning for it again. Discovery of the link
+// that just came up carries on meanwhile. Returns true if a connection was
+// initiated.
+static bool connect_next_heard(void)
+{
+	struct scan_cache_entry best;
+	char addr_str[BT_ADDR_LE_STR_LEN];
+
+	if (!CONFIG_APP_CONNECT_PIPELINE_AGE_MS || auto_connecting || scan_accept_list ||
+	    !scan_cache_best_candidate(CONFIG_APP_CONNECT_PIPELINE_AGE_MS, &best)) {
+		return false;
+	}
+
+	bt_addr_le_to_str(&best.addr, addr_str, sizeof(addr_str));
+	LOG_INF("Next candidate %s (RSSI avg %d), heard %u ms ago", addr_str,
+		scan_cache_rssi_avg(&best), k_uptime_get_32() - best.last_seen);
+
+	connect_bulb(&best.addr, bulb_profile_get(best.profile), scan_cache_rssi_avg(&best));
+
+	return bulb_connecting();
+}
+
+static void device_found(const struct bt_le_scan_recv_info *info, struct net_buf_simple *ad);
+
+// Reports come with their PHY and advertising properties, legacy or extended
+static struct bt_le_scan_cb scan_callbacks = {
+	.recv = device_found,
+};
+
+// At most one scan report is logged per CONFIG_APP_SCAN_LOG_INTERVAL_MS, the
+// others are only counted. Called from the BT RX thread only.
+static bool scan_log_allowed(uint32_t *suppressed)
+{
+	static uint32_t last_ms;
+	static uint32_t dropped;
+	uint32_t now = k_uptime_get_32();
+
+	if (last_ms && (now - last_ms) < CONFIG_APP_SCAN_LOG_INTERVAL_MS) {
+		dropped++;
+		return false;
+	}
+
+	last_ms = MAX(now, 1U);
+	*suppressed = dropped;
+	dropped = 0;
+
+	return true;
+}
+
+// Profile of a bulb recognised by its address alone: matched earlier in this
+// scan or connected before. -1 if the address is not known.
+static int known_bulb_profile(const bt_addr_le_t *addr, const struct scan_cache_entry *entry)
+{
+	if (entry->matched) {
+		return entry->profile;
+	}
+
+	if (fleet_find(addr) >= 0) {
+		return fleet_profile(addr);
+	}
+
+	return -1;
+}
+
+static const char *adv_type_str(uint8_t type)
+{
+	switch (type) {
+	case BT_GAP_ADV_TYPE_SCAN_RSP:
+		return "Scan Response";
+	case BT_GAP_ADV_TYPE_EXT_ADV:
+		return "Extended Advertisement";
+	default:
+		return "Regular Advertisement";
+	}
+}
+
+static void device_found(const struct bt_le_scan_recv_info *info, struct net_buf_simple *ad)
+{
+	const bt_addr_le_t *addr = info->addr;
+	int8_t rssi = info->rssi;
+	uint8_t type = info->adv_type;
+	char addr_str[BT_ADDR_LE_STR_LEN];
+	char name_str[SCAN_LOG_NAME_MAX + 1];
+	struct scan_cache_entry entry;
+	const char *name = "";
+	uint32_t suppressed;
+	uint8_t name_len;
+	bool duplicate;
+	bool known = false;
+	int profile;
+	CENTRAL_TRACE("central_scan_recv", 0);
+
+	central_stats_scan_report();
+
+	// Without a parallel initiator the scan is stopped while connecting, drop the stragglers
+	if (bulb_connecting() && !IS_ENABLED(CONFIG_BT_SCAN_AND_INITIATE_IN_PARALLEL)) {
+		return;
+	}
 
-	if (strncmp(PERIPHERAL_NAME, device_ad_data.name, strlen(PERIPHERAL_NAME)) == 0)
+	// Legacy ADV_IND and its scan response, or a connectable extended advertisement
+	if (type != BT_GAP_ADV_TYPE_ADV_IND && type != BT_GAP_ADV_TYPE_SCAN_RSP &&
+	    !(type == BT_GAP_ADV_TYPE_EXT_ADV && (info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE)))
 	{
-		if (bt_le_scan_stop()) {
-			return;
+		return;
+	}
+
+	// The controller already filtered on known bulb addresses, no need to look at the name
+	if (scan_accept_list) {
+		central_stats_scan_match();
+		connect_bulb(addr, bulb_profile_get(fleet_profile(addr)), rssi);
+		return;
+	}
+
+	// Every report feeds the RSSI statistics, repeats are dropped after that
+	scan_cache_update(addr, rssi, &entry, &duplicate);
+	if (entry.rejected || (duplicate && entry.matched)) {
+		return;
+	}
+
+	// Matched in place inside the report, nothing is copied for the devices we ignore
+	profile = bulb_profile_match(ad);
+
+	// Fast path: a repeat peer needs neither its name nor a scan request
+	if (profile < 0 && IS_ENABLED(CONFIG_APP_SCAN_FAST_PATH)) {
+		profile = known_bulb_profile(addr, &entry);
+		known = profile >= 0;
+	}
+
+	if (profile < 0) {
+		// The name may still come in the scan response, only give up after that.
+		// A connectable extended advertisement has none, it carries everything.
+		if ((type == BT_GAP_ADV_TYPE_SCAN_RSP || type == BT_GAP_ADV_TYPE_EXT_ADV) &&
+		    !entry.matched) {
+			scan_cache_reject(addr);
 		}
+		return;
+	}
 
-		err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN,
-						BT_LE_CONN_PARAM_DEFAULT, &default_conn);
-			if (err) {
-				printk("Create conn to %s failed (%d)\n", addr_str, err);
-				start_scan();
-			}
-	}	
+	scan_cache_matched(addr, profile);
+	central_stats_scan_match();
+	latency_scan_hit();
+	scan_duty_hit();
+
+	if (scan_log_allowed(&suppressed)) {
+		bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
+
+		// Deferred logging needs a terminated copy, the report is gone by the time it prints
+		name_len = MIN(adv_match_name(ad, &name), SCAN_LOG_NAME_MAX);
+		memcpy(name_str, name, name_len);
+		name_str[name_len] = '\0';
+
+		LOG_INF("Device found [%s]: %s with name [%d]: |%s|, %s%s (RSSI %d, avg %d, %u reports not logged)",
+				adv_type_str(type),
+				addr_str,
+				name_len,
+				name_str,
+				bulb_profile_get(profile)->name,
+				known ? ", known address" : "",
+				rssi, scan_cache_rssi_avg(&entry), suppressed);
+	}
+
+	// A known bulb is ours anyway, there is nothing to pick between
+	if (known || !CONFIG_APP_SCAN_CANDIDATE_WINDOW_MS) {
+		connect_bulb(addr, bulb_profile_get(profile), scan_cache_rssi_avg(&entry));
+		return;
+	}
+
+	// Collect other candidates for a moment, the first bulb heard is rarely the closest
+	(void)k_work_schedule_for_queue(&bulb_workq, &candidate_work,
+					K_MSEC(CONFIG_APP_SCAN_CANDIDATE_WINDOW_MS));
 }
 
 static uint8_t notify_func(struct bt_conn *conn,
 			   struct bt_gatt_subscribe_params *params,
 			   const void *data, uint16_t length)
 {
-	uint8_t *battery_level = ((uint8_t *)data);
+	bulb_conn_t *bulb = CONTAINER_OF(params, bulb_conn_t, subscribe_params);
+	CENTRAL_TRACE("central_notify", bt_conn_index(conn));
 
 	if (!data) {
-		printk("[UNSUBSCRIBED]\n");
+		LOG_WRN("[UNSUBSCRIBED] bulb %d", bulb_index(bulb));
 		params->value_handle = 0U;
 		return BT_GATT_ITER_STOP;
 	}
 
-	printk("Received notification for Battery Level (%u): %u%%\n", length, *battery_level);
+	// Handled by notify_batch_handler(), the RX thread only copies it out
+	(void)notify_ring_push(conn, params->value_handle, data, length);
 
 	return BT_GATT_ITER_CONTINUE;
 }
 
-static uint8_t discover_func(struct bt_conn *conn,
-			     const struct bt_gatt_attr *attr,
-			     struct bt_gatt_discover_params *params)
+// Runs on the notification consumer thread
+static void notify_batch_handler(const struct notify_event *evts, size_t count)
 {
-	int err;
+	for (size_t i = 0; i < count; i++) {
+		const struct notify_event *evt = &evts[i];
+		bulb_conn_t *bulb = bulb_find(evt->conn);
 
-	if (!attr) {
-		printk("Discover complete\n");
-		(void)memset(params, 0, sizeof(*params));
-		return BT_GATT_ITER_STOP;
+		if (IS_ENABLED(CONFIG_APP_BENCH)) {
+			bench_notify(evt->conn, evt->len);
+		}
+
+		if (!bulb || evt->handle != bulb->battery_level_value_handle || !evt->len) {
+			continue;
+		}
+
+		LOG_INF("Received notification for Battery Level (%u) of bulb %d: %u%%",
+			evt->len, bulb_index(bulb), evt->value[0]);
+		central_stats_notify(bulb_index(bulb));
+
+		if (IS_ENABLED(CONFIG_APP_BATTERY_LOG) && bulb->battery_logged) {
+			battery_log_update(bulb->battery_series, evt->value[0]);
+		}
 	}
+}
 
-	printk("Discovered [ATTRIBUTE] with handle %u\n", attr->handle);
+static void store_handles(bulb_conn_t *bulb)
+{
+	struct gatt_cache_entry entry = {
+		.color_attr_handle = bulb->color_attr_handle,
+		.battery_level_value_handle = bulb->battery_level_value_handle,
+		.battery_level_ccc_handle = bulb->subscribe_params.ccc_handle,
+		.has_db_hash = bulb->has_db_hash,
+	};
+
+	if (!IS_ENABLED(CONFIG_APP_GATT_CACHE)) {
+		return;
+	}
 
-	// Discovered the Color Characteristic
-	if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_COLOR_SETTING)) {
+	bt_addr_le_copy(&entry.addr, bt_conn_get_dst(bulb->conn));
+	memcpy(entry.db_hash, bulb->db_hash, sizeof(entry.db_hash));
 
-		printk("Discovery of Color Setting Characteristic Successful\n");
-		// color_attr_handle = ((struct bt_gatt_chrc *)attr->user_data)->value_handle;
-		color_attr_handle = bt_gatt_attr_value_handle(attr);
-		printk("Color Setting Characteristic Handle = %u\n", color_attr_handle);
+	gatt_cache_store(&entry);
+}
 
-		// Move on to discovering the Battery Level Characteristic
-		memcpy(&discover_uuid, BT_UUID_BAS_BATTERY_LEVEL, sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.start_handle = attr->handle + 1;
-		discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+static int start_discovery(bulb_conn_t *bulb);
 
-		err = bt_gatt_discover(conn, &discover_params);
-		if (err) {
-			printk("Discover failed (err %d)\n", err);
-		}
+static void setup_slot_release(bulb_conn_t *bulb)
+{
+	if (bulb->setup_slot) {
+		bulb->setup_slot = false;
+		gatt_sched_done(&bulb->setup_op);
 	}
-	// Discovered the Battery Level Characteristic
-	else if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_BAS_BATTERY_LEVEL)) {
+}
 
-		printk("Discovery of Battery Level Characteristic Successful\n");
-		// battery_level_value_handle = ((struct bt_gatt_chrc *)attr->user_data)->value_handle;
-		battery_level_value_handle = bt_gatt_attr_value_handle(attr);
-		printk("Battery Level Characteristic Handle = %u\n", battery_level_value_handle);
-		
-		// Move on to discovering the Battery Level Characteristic CCCD (to enable notifications)
-		memcpy(&discover_uuid, BT_UUID_GATT_CCC, sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.start_handle = attr->handle + 2;
-		discover_params.type = BT_GATT_DISCOVER_DESCRIPTOR;
-		subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
+static void discovery_complete(bulb_conn_t *bulb, int err)
+{
+	setup_slot_release(bulb);
 
-		err = bt_gatt_discover(conn, &discover_params);
-		if (err) {
-			printk("Discover failed (err %d)\n", err);
-		}
+	bulb->discovery_err = err;
+	bulb_post(bulb, err ? BULB_EVT_DISCOVERY_FAILED : BULB_EVT_DISCOVERED);
+}
+
+// A bring-up step failed with err. Returns true if it is tried again after a
+// backoff, false if the error will not clear up or the retries are used up.
+static bool setup_retry(bulb_conn_t *bulb, bulb_retry_t step, int err)
+{
+	int delay;
+
+	if (!recovery_transient(err)) {
+		return false;
 	}
-	else if (!bt_uuid_cmp(discover_params.uuid, BT_UUID_GATT_CCC))
-	{
-		printk("Discovery of Battery Level Characteristic CCCD Successful. Subscribing to notifications now.\n");
 
-		subscribe_params.notify = notify_func;
-		subscribe_params.value = BT_GATT_CCC_NOTIFY;
-		subscribe_params.ccc_handle = attr->handle;
+	// Set first, the retry may run on bulb_workq before this returns
+	bulb->retry_step = step;
 
-		err = bt_gatt_subscribe(conn, &subscribe_params);
-		if (err && err != -EALREADY) {
-			printk("Subscribe failed (err %d)\n", err);
-		} else {
-			printk("[SUBSCRIBED]\n");
-		}
+	// Other links get the slot during the backoff, the retry queues setup_op again
+	setup_slot_release(bulb);
 
-		k_sem_give(&sem_discovered);
-		return BT_GATT_ITER_STOP;
+	delay = recovery_retry(&bulb->recovery, &bulb_workq);
+	if (delay < 0) {
+		LOG_WRN("Bulb %d: %s still failing (err %d), giving up", bulb_index(bulb),
+			bulb_retry_names[step], err);
+		return false;
 	}
 
-	return BT_GATT_ITER_STOP;
+	LOG_WRN("Bulb %d: %s failed (err %d), retrying in %d ms", bulb_index(bulb),
+		bulb_retry_names[step], err, delay);
+
+	return true;
 }
 
-static void start_scan(void)
+static void subscribe_func(struct bt_conn *conn, uint8_t err,
+			   struct bt_gatt_subscribe_params *params)
 {
-	int err;
+	bulb_conn_t *bulb = CONTAINER_OF(params, bulb_conn_t, subscribe_params);
+	int ret;
+	CENTRAL_TRACE("central_subscribed", bt_conn_index(conn));
+
+	// The CCCD write
+	central_stats_discovery_ops(bulb_index(bulb), 1);
+
+	if (IS_ENABLED(CONFIG_APP_GATT_CACHE) && err && bulb->handles_from_cache) {
+		// Cached handles are stale, forget them and discover from scratch
+		LOG_WRN("Subscribe with cached handles failed (err 0x%02x), rediscovering", err);
+		gatt_cache_invalidate(bt_conn_get_dst(conn));
+		bulb->handles_from_cache = false;
+
+		ret = start_discovery(bulb);
+		if (ret && !setup_retry(bulb, BULB_RETRY_DISCOVERY, ret)) {
+			discovery_complete(bulb, ret);
+		}
+		return;
+	}
 
-	err = bt_le_scan_start(BT_LE_SCAN_ACTIVE, device_found);
-	if (err) {
-		printk("Scanning failed to start (err %d)\n", err);
+	// The CCCD write is repeated if the bulb was only short of resources
+	if (err && setup_retry(bulb, BULB_RETRY_SUBSCRIBE, err)) {
 		return;
 	}
 
-	printk("Scanning successfully started\n ==> Will only be scanning devices with a NON-EMPTY device name <==\n");
+	if (err) {
+		LOG_ERR("Subscribe failed (err 0x%02x)", err);
+	} else {
+		LOG_INF("[SUBSCRIBED]");
+		latency_mark(bulb_index(bulb), LATENCY_SUBSCRIBED);
+		if (!bulb->handles_from_cache) {
+			store_handles(bulb);
+		}
+	}
+
+	// Notifications are a nice to have, the bulb is usable without them
+	discovery_complete(bulb, 0);
 }
 
-static void connected(struct bt_conn *conn, uint8_t err)
+static int subscribe_battery_level(bulb_conn_t *bulb)
 {
-	char addr[BT_ADDR_LE_STR_LEN];
+	int err;
 
-	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+	bulb->subscribe_params.notify = notify_func;
+	bulb->subscribe_params.subscribe = subscribe_func;
+	bulb->subscribe_params.value = BT_GATT_CCC_NOTIFY;
 
+	err = bt_gatt_subscribe(bulb->conn, &bulb->subscribe_params);
+	if (err == -EALREADY) {
+		// No CCCD write needed, subscribe_func() will not be called
+		LOG_INF("[SUBSCRIBED]");
+		latency_mark(bulb_index(bulb), LATENCY_SUBSCRIBED);
+		discovery_complete(bulb, 0);
+		return 0;
+	}
 	if (err) {
-		printk("Failed to connect to %s %u %s\n", addr, err, bt_hci_err_to_str(err));
+		LOG_ERR("Subscribe failed (err %d)", err);
+	}
 
-		bt_conn_unref(default_conn);
-		default_conn = NULL;
+	return err;
+}
 
-		start_scan();
-		return;
+static void discovery_done(struct bt_conn *conn, struct gatt_discovery *disc, int err)
+{
+	bulb_conn_t *bulb = CONTAINER_OF(disc, bulb_conn_t, discovery);
+	const struct gatt_discovery_result *color = &bulb->discovery_results[BULB_CHRC_COLOR];
+	const struct gatt_discovery_result *battery = &bulb->discovery_results[BULB_CHRC_BATTERY_LEVEL];
+	bool notify = bulb->profile->chrcs[BULB_CHRC_BATTERY_LEVEL].need_ccc;
+	CENTRAL_TRACE("central_discovered", bt_conn_index(conn));
+
+	central_stats_discovery_ops(bulb_index(bulb), disc->procedures);
+
+	if (!err && (!color->value_handle || !battery->value_handle ||
+		     (notify && !battery->ccc_handle))) {
+		LOG_ERR("Bulb %d is missing a required characteristic", bulb_index(bulb));
+		err = -ENOENT;
 	}
 
-	if (conn != default_conn) {
+	if (err) {
+		if (!setup_retry(bulb, BULB_RETRY_DISCOVERY, err)) {
+			discovery_complete(bulb, err);
+		}
 		return;
 	}
 
-	printk("Connected: %s\n", addr);
-}
+	latency_mark_at(bulb_index(bulb), LATENCY_CHRC_SWEEP, disc->sweep_done_cycles);
+	latency_mark(bulb_index(bulb), LATENCY_CCC_DISCOVERY);
 
-static void disconnected(struct bt_conn *conn, uint8_t reason)
-{
-	char addr[BT_ADDR_LE_STR_LEN];
+	bulb->color_attr_handle = color->value_handle;
+	LOG_DBG("Color Setting Characteristic Handle = %u", bulb->color_attr_handle);
 
-	if (conn != default_conn) {
+	bulb->battery_level_value_handle = battery->value_handle;
+	LOG_DBG("Battery Level Characteristic Handle = %u", bulb->battery_level_value_handle);
+
+	if (!notify) {
+		// The battery level of this model is only ever read
+		discovery_complete(bulb, 0);
 		return;
 	}
 
-	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+	LOG_DBG("Battery Level Characteristic CCCD found. Subscribing to notifications now.");
 
-	printk("Disconnected: %s, reason 0x%02x %s\n", addr, reason, bt_hci_err_to_str(reason));
+	bulb->subscribe_params.value_handle = battery->value_handle;
+	bulb->subscribe_params.ccc_handle = battery->ccc_handle;
 
-	bt_conn_unref(default_conn);
-	default_conn = NULL;
-	k_sem_give(&sem_disconnected);
+	err = subscribe_battery_level(bulb);
+	if (err && !setup_retry(bulb, BULB_RETRY_SUBSCRIBE, err)) {
+		discovery_complete(bulb, err);
+	}
 }
 
-void remote_info_available_cb(struct bt_conn *conn, struct bt_conn_remote_info *remote_info)
+static void start_accept_list_connect(void)
 {
-	printk("Remote info from connected device available. We can now discover the GATT database\n");
-
-	k_sem_give(&sem_connected);
-}
+	int count;
+	int err;
 
-BT_CONN_CB_DEFINE(conn_callbacks) = {
-	.connected = connected,
-	.disconnected = disconnected,
-    .remote_info_available = remote_info_available_cb
-};
+	if (!fleet_disconnected_count()) {
+		LOG_INF("Every known bulb is connected, not scanning");
+		return;
+	}
 
-static uint8_t battery_read_func(struct bt_conn *conn, uint8_t err,
-	struct bt_gatt_read_params *params,
-	const void *data, uint16_t length)
-{
-	printk("Battery Level = %u%%\n", *((uint8_t *)data));
+	// The accept list can only be changed while it is not in use
+	(void)stop_scan();
+	scan_accept_list = false;
 
-	return BT_GATT_ITER_STOP;
-}
+	count = fleet_accept_list_sync();
+	if (count <= 0) {
+		LOG_ERR("Filter accept list setup failed (err %d)", count);
+		return;
+	}
 
-static int read_battery_level(void)
-{
-	int err;
+	// Let the controller filter the advertisers and connect on its own
+	err = bt_conn_le_create_auto(BT_CONN_LE_CREATE_PARAM(CONN_CREATE_OPTIONS,
+							     BT_GAP_SCAN_FAST_INTERVAL,
+							     BT_GAP_SCAN_FAST_WINDOW),
+				     BT_LE_CONN_PARAM_DEFAULT);
+	if (!err) {
+		auto_connecting = true;
+		LOG_INF("Auto-connecting to %d known bulb(s) on the filter accept list", count);
+		return;
+	}
 
-	read_params.func = battery_read_func;
-	read_params.handle_count  = 1;
-	read_params.single.handle = battery_level_value_handle;
-	read_params.single.offset = 0;
+	// Initiator not available, let the scanner filter instead and connect from device_found()
+	LOG_WRN("Auto-connect failed (err %d), scanning the filter accept list instead", err);
 
-	err = bt_gatt_read(default_conn, &read_params);
-	if (err)
-	{
-		printk("Read not successful!\n");
+	err = bt_le_scan_start(SCAN_PARAM_ACCEPT_LIST, NULL);
+	if (err && err != -EALREADY) {
+		LOG_ERR("Scanning failed to start (err %d)", err);
+		return;
 	}
 
-	return err;
+	scan_accept_list = true;
 }
 
-static void button_state_changed(uint32_t button_state, uint32_t has_changed)
+// Bulbs of a fixed size fleet without a link, 0 when the fleet size is open
+static size_t bulbs_missing(void)
 {
-    if ((has_changed & BUTTON_COLOR) && (button_state & BUTTON_COLOR))
-	{	
-		printk("Changing color to next one in array\n");
-		current_color_index = (current_color_index + 1) % COLOR_COUNT;
-		toggle_color();
-    }
-	if ((has_changed & BUTTON_BATTERY_LEVEL) && (button_state & BUTTON_BATTERY_LEVEL))
-	{
-		printk("Reading the Battery Level\n");
-		read_battery_level();
-	}
-	if ((has_changed & BUTTON_CONN_PARAMS) && (button_state & BUTTON_CONN_PARAMS))
-	{
-		struct bt_conn_info info;
-		printk("Current Connection Parameters\n");
-		bt_conn_get_info(default_conn, &info);
-		printk("Interval: %0.2f ms, Latency: %u, Timeout: %u ms\n",
-			info.le.interval*1.25,
-			info.le.latency,
-			info.le.timeout*10); 
-
-		printk("Updating Connection Parameters\n");
-		struct bt_le_conn_param *param = BT_LE_CONN_PARAM(6, 6, 0, 400);
-		bt_conn_le_param_update(default_conn, param);
-
-		printk("Updated Connection Parameters\n");
-		printk("Interval: %0.2f ms, Latency: %u, Timeout: %u ms\n", 
-			param->interval_min*1.25,
-			param->latency,
-			param->timeout*10);
-
-		// Changing PHY - Not supported by the PlayBulb Candle device, but can be applied with other devices
-		// struct bt_conn_le_phy_param phy_param;
-		// phy_param.pref_tx_phy = BT_GAP_LE_PHY_2M;
-		// phy_param.pref_tx_phy = BT_GAP_LE_PHY_2M;
-		// bt_conn_le_phy_update(default_conn, &phy_param);
-	}
-	if ((has_changed & BUTTON_DISCONNECT) && (button_state & BUTTON_DISCONNECT))
-	{
-		printk("Disconnecting from device\n");
-		bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+	size_t connected = fleet_count() - fleet_disconnected_count();
+
+	if (!CONFIG_APP_FLEET_SIZE) {
+		// Nothing connected at all certainly means something is missing
+		return connected ? 0 : 1;
 	}
+
+	return connected < CONFIG_APP_FLEET_SIZE ? CONFIG_APP_FLEET_SIZE - connected : 0;
 }
 
-static int init_buttons(void)
+// The fleet is steady: nothing was sent for a while and every known bulb is connected
+static bool scan_parked(void)
 {
-    return dk_buttons_init(button_state_changed);
+	return IS_ENABLED(CONFIG_APP_IDLE_PARK_SCAN) && idle_policy_idle() && fleet_count() &&
+	       !fleet_disconnected_count() && !bulbs_missing();
 }
 
-static int toggle_color(void)
+static int stop_scan(void)
 {
 	int err;
 
-	printk("Setting color to: %s\n", color_array[current_color_index].color_name);
-
-	err = bt_gatt_write_without_response(default_conn,
-										 color_attr_handle,
-										 &(color_array[current_color_index].color_value),
-										 sizeof(uint32_t),
-										 false);
-	if (err) {
-		printk("Write failed (err %d)\n", err);
-	}
-	else // Write sent successfully
-	{
-		printk("Write without response sent successfully.\n");
-	}
+	(void)k_mutex_lock(&scan_lock, K_FOREVER);
+	scan_running = false;
+	err = bt_le_scan_stop();
+	(void)k_mutex_unlock(&scan_lock);
 
 	return err;
 }
 
+#if defined(CONFIG_APP_SCAN_ADAPTIVE)
+static void scan_adapt_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(scan_adapt_work, scan_adapt_handler);
 
-int main(void)
+// Re-evaluated periodically, the name based scan is restarted when its level changes
+static void scan_adapt_handler(struct k_work *work)
 {
+	(void)k_mutex_lock(&scan_lock, K_FOREVER);
+	if (scan_running && !scan_accept_list &&
+	    scan_duty_select(bulbs_missing()) != scan_level) {
+		(void)stop_scan();
+		start_scan();
+	}
+	(void)k_mutex_unlock(&scan_lock);
+
+	(void)k_work_schedule_for_queue(&bulb_workq, &scan_adapt_work,
+				       K_MSEC(CONFIG_APP_SCAN_ADAPT_PERIOD_MS));
+}
+#endif /* CONFIG_APP_SCAN_ADAPTIVE */
+
+// With scan_lock held
+static void start_scan_locked(void)
+{
+	const struct bt_le_scan_param *param;
+	enum scan_duty_level level;
 	int err;
 
-	err = init_buttons();
-	if (err)
-	{
-		printk("Cannot init buttons (err: %d)\n", err);
-		return 0;
+	// Nothing to look for once every connection slot is in use
+	if (!bulb_slot_available()) {
+		LOG_INF("All %d connection slots in use, not scanning", CONFIG_BT_MAX_CONN);
+		return;
 	}
 
-	err = bt_enable(NULL);
-	if (err) {
-		printk("Bluetooth init failed (err %d)\n", err);
-		return 0;
+	// Scanning is resumed from connected() once the pending connection completes
+	if (bulb_connecting() || auto_connecting) {
+		return;
 	}
 
-	printk("Bluetooth initialized\n");
+	// Resumed by the next command or when a bulb drops out
+	if (scan_parked()) {
+		LOG_INF("Every known bulb is connected and idle, scan parked");
+		return;
+	}
 
-	while (1)
-	{
-		// Continuously scan
-		start_scan();
+	// Once every bulb of the fleet is known there is no need to look at names anymore
+	if (IS_ENABLED(CONFIG_APP_SCAN_ACCEPT_LIST) && fleet_complete()) {
+		start_accept_list_connect();
+		return;
+	}
 
-		// Wait for a connection to happen
-		k_sem_take(&sem_connected, K_FOREVER);
-
-		// Once connected, we discover the GATT database of the connected Peripheral
-		memcpy(&discover_uuid, BT_UUID_COLOR_SETTING, sizeof(discover_uuid));
-		discover_params.uuid = &discover_uuid.uuid;
-		discover_params.func = discover_func;
-		discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
-		discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
-		discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
-		err = bt_gatt_discover(default_conn, &discover_params);
-		if (err) {
-			printk("Discovery failed (err %d)\n", err);
-		}
-		else // Discovery started successfully
-		{
-			printk("Discovery started\n");
+	if (scan_accept_list) {
+		(void)stop_scan();
+		scan_accept_list = false;
+	}
 
-			err = k_sem_take(&sem_discovered, K_SECONDS(10));
-			if (err) {
-				printk("Timed out during GATT discovery\n");
-			}
-			else // Discovery completed successfully
-			{
-				printk("Discovered the device's characteristics.\n");
+	level = scan_duty_select(bulbs_missing());
+	param = scan_duty_param(level);
 
-				// Stay in this state until a disconnect occurs.
-				printk("Wait here for user button presses as long as we're still connected...\n");
+	err = bt_le_scan_start(param, NULL);
+	if (err == -EALREADY) {
+		return;
+	}
+	if (err) {
+		LOG_ERR("Scanning failed to start (err %d)", err);
+		return;
+	}
 
-				k_sem_take(&sem_disconnected,  K_FOREVER);
-			}
-		}
+	scan_running = true;
+	scan_level = level;
 
-		if (err)
-		{
-			// In case of an error, disconnect from the device
-			err = bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
-			if (err) {
-				printk("Failed to disconnect (err %d)\n", err);
-				return 0;
-			}
+	LOG_INF("Scanning started (%s: " INTERVAL_MS_FMT " every " INTERVAL_MS_FMT
+		", link load %u permille), reporting devices matching the bulb rules only",
+		scan_duty_name(level), SCAN_MS_ARGS(param->window), SCAN_MS_ARGS(param->interval),
+		scan_duty_link_load());
+}
+
+static void start_scan(void)
+{
+	(void)k_mutex_lock(&scan_lock, K_FOREVER);
+	start_scan_locked();
+	(void)k_mutex_unlock(&scan_lock);
+}
+
+// Connection created by the controller from the filter accept list, with
+// scan_lock held. Returns the slot it was given, NULL if it was not one of
+// ours or failed.
+static bulb_conn_t *auto_connected_locked(struct bt_conn *conn, uint8_t err)
+{
+	bulb_conn_t *bulb;
+
+	if (!auto_connecting) {
+		return NULL;
+	}
+
+	auto_connecting = false;
+
+	if (err) {
+		LOG_ERR("Auto-connect failed %u %s", err, bt_hci_err_to_str(err));
+		start_scan();
+		return NULL;
+	}
+
+	bulb = bulb_alloc();
+	if (!bulb) {
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		return NULL;
+	}
+
+	bulb->conn = bt_conn_ref(conn);
+	bulb->state = BULB_STATE_CONNECTING;
+	bulb->profile = bulb_profile_get(fleet_profile(bt_conn_get_dst(conn)));
+	bulb->rssi = BT_HCI_LE_RSSI_NOT_AVAILABLE;
+	latency_start(bulb_index(bulb), false);
+
+	return bulb;
+}
+
+static bulb_conn_t *auto_connected(struct bt_conn *conn, uint8_t err)
+{
+	bulb_conn_t *bulb;
+
+	(void)k_mutex_lock(&scan_lock, K_FOREVER);
+	bulb = auto_connected_locked(conn, err);
+	(void)k_mutex_unlock(&scan_lock);
+
+	return bulb;
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+	bulb_conn_t *bulb;
+	CENTRAL_TRACE("central_connected", bt_conn_index(conn));
+
+	bulb = bulb_find(conn);
+	if (!bulb) {
+		bulb = auto_connected(conn, err);
+	}
+	if (!bulb) {
+		return;
+	}
+
+	if (err) {
+		bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+		LOG_ERR("Failed to connect to %s %u %s", addr, err, bt_hci_err_to_str(err));
+
+		bulb->connect_err = err;
+		bulb_post(bulb, BULB_EVT_CONNECT_FAILED);
+		return;
+	}
+
+	latency_mark(bulb_index(bulb), LATENCY_CONNECTED);
+	bulb_post(bulb, BULB_EVT_CONNECTED);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+	bulb_conn_t *bulb;
+	CENTRAL_TRACE("central_disconnected", bt_conn_index(conn));
+
+	bulb = bulb_find(conn);
+	if (!bulb) {
+		return;
+	}
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	LOG_INF("Disconnected: %s (bulb %d), reason 0x%02x %s", addr, bulb_index(bulb),
+		reason, bt_hci_err_to_str(reason));
+	central_stats_disconnected(bulb_index(bulb), reason);
+
+	bulb_post(bulb, BULB_EVT_DISCONNECTED);
+}
+
+void remote_info_available_cb(struct bt_conn *conn, struct bt_conn_remote_info *remote_info)
+{
+	bulb_conn_t *bulb;
+	CENTRAL_TRACE("central_remote_info", bt_conn_index(conn));
+
+	bulb = bulb_find(conn);
+	if (!bulb) {
+		return;
+	}
+
+	// Only acted upon in BULB_STATE_CONNECTED, later updates are ignored
+	latency_mark(bulb_index(bulb), LATENCY_REMOTE_INFO);
+	bulb_post(bulb, BULB_EVT_REMOTE_INFO);
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.remote_info_available = remote_info_available_cb,
+};
+
+static void state_synced(struct bt_conn *conn, struct state_sync *sync, int err)
+{
+	bulb_conn_t *bulb = CONTAINER_OF(sync, bulb_conn_t, state_sync);
+	const struct state_sync_value *color = &bulb->state_values[BULB_CHRC_COLOR];
+	const struct state_sync_value *battery = &bulb->state_values[BULB_CHRC_BATTERY_LEVEL];
+	const uint8_t color_len = bulb->profile->value_lens[BULB_CHRC_COLOR];
+	CENTRAL_TRACE("central_state_read", bt_conn_index(conn));
+
+	central_stats_read(bulb_index(bulb), sync->round_trips, err);
+
+	if (err) {
+		LOG_WRN("State read of bulb %d incomplete (err %d)", bulb_index(bulb), err);
+	}
+
+	if (color->valid && color->data_len == color_len) {
+		LOG_INF("Color of bulb %d = %02x %02x %02x %02x", bulb_index(bulb),
+			color->data[0], color->data[1], color->data[2], color->data[3]);
+	}
+
+	if (battery->valid && battery->data_len) {
+		LOG_INF("Battery Level of bulb %d = %u%%", bulb_index(bulb), battery->data[0]);
+
+		if (IS_ENABLED(CONFIG_APP_BATTERY_LOG) && bulb->battery_logged) {
+			battery_log_update(bulb->battery_series, battery->data[0]);
+		}
+	}
+
+	// Answers HOST_CMD_READ_STATE, a level of 0xFF or a zero colour means not read
+	if (IS_ENABLED(CONFIG_APP_HOST_CMD)) {
+		uint8_t state[5] = { [4] = 0xFF };
+
+		if (color->valid && color->data_len == color_len) {
+			memcpy(state, color->data, color_len);
+		}
+		if (battery->valid && battery->data_len) {
+			state[4] = battery->data[0];
+		}
+
+		(void)host_cmd_event(HOST_EVT_STATE, bulb_index(bulb), state, sizeof(state));
+	}
+
+	LOG_DBG("State of bulb %d read in %u round trip(s)", bulb_index(bulb), sync->round_trips);
+}
+
+// Read every known characteristic value of the bulb, in one round trip where the peer allows
+static int read_bulb_state(bulb_conn_t *bulb)
+{
+	const uint16_t handles[BULB_CHRC_COUNT] = {
+		[BULB_CHRC_COLOR] = bulb->color_attr_handle,
+		[BULB_CHRC_BATTERY_LEVEL] = bulb->battery_level_value_handle,
+	};
+	int err;
+
+	for (size_t i = 0; i < BULB_CHRC_COUNT; i++) {
+		bulb->state_values[i].handle = handles[i];
+		bulb->state_values[i].len = bulb->profile->value_lens[i];
+	}
+
+	err = state_sync_start(bulb->conn, &bulb->state_sync, bulb->state_values,
+			       BULB_CHRC_COUNT, state_synced);
+	if (err) {
+		LOG_WRN("State read of bulb %d not started (err %d)", bulb_index(bulb), err);
+	}
+
+	return err;
+}
+
+static void update_conn_params(bulb_conn_t *bulb)
+{
+	struct bt_conn_info info;
+
+	LOG_INF("Current Connection Parameters of bulb %d", bulb_index(bulb));
+	bt_conn_get_info(bulb->conn, &info);
+	LOG_INF("Interval: " INTERVAL_MS_FMT ", Latency: %u, Timeout: %u ms",
+		INTERVAL_MS_ARGS(info.le.interval),
+		info.le.latency,
+		info.le.timeout*10);
+
+	// Re-run the negotiation done after connecting (PHY, data length, MTU, interval)
+	if (IS_ENABLED(CONFIG_APP_LINK_TUNING)) {
+		LOG_INF("Re-running link tuning");
+		link_tuning_start(bulb->conn, bulb->rssi, NULL);
+		return;
+	}
+
+	LOG_INF("Updating Connection Parameters");
+	struct bt_le_conn_param *param = BT_LE_CONN_PARAM(6, 6, 0, 400);
+	bt_conn_le_param_update(bulb->conn, param);
+
+	LOG_INF("Updated Connection Parameters");
+	LOG_INF("Interval: " INTERVAL_MS_FMT ", Latency: %u, Timeout: %u ms",
+		INTERVAL_MS_ARGS(param->interval_min),
+		param->latency,
+		param->timeout*10);
+}
+
+static void button_state_changed(uint32_t button_state, uint32_t has_changed)
+{
+	uint32_t pressed = button_state & has_changed;
+
+	if (pressed && IS_ENABLED(CONFIG_APP_IDLE)) {
+		idle_policy_activity();
+	}
+
+	if (pressed & BUTTON_COLOR) {
+		// A manual colour change ends the running effect
+		if (IS_ENABLED(CONFIG_APP_ANIM)) {
+			animation_stop();
+		}
+
+		LOG_INF("Changing color to next one in array");
+		current_color_index = (current_color_index + 1) % COLOR_COUNT;
+
+		if (IS_ENABLED(CONFIG_APP_COLOR_SYNC)) {
+			set_color_all();
+		}
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		bulb_conn_t *bulb = &conn_table[i];
+
+		if (bulb->state != BULB_STATE_READY) {
+			continue;
+		}
+
+		if ((pressed & BUTTON_COLOR) && !IS_ENABLED(CONFIG_APP_COLOR_SYNC)) {
+			toggle_color(bulb);
+		}
+		if (pressed & BUTTON_BATTERY_LEVEL) {
+			LOG_INF("Reading the Battery Level");
+			read_bulb_state(bulb);
+		}
+		if (pressed & BUTTON_CONN_PARAMS) {
+			update_conn_params(bulb);
+		}
+		if (pressed & BUTTON_DISCONNECT) {
+			LOG_INF("Disconnecting from bulb %d", bulb_index(bulb));
+			bulb_post(bulb, BULB_EVT_DISCONNECT);
+		}
+	}
+}
+
+static int init_buttons(void)
+{
+	return dk_buttons_init(button_state_changed);
+}
+
+static int toggle_color(bulb_conn_t *bulb)
+{
+	int err;
+
+	LOG_INF("Setting color of bulb %d to: %s", bulb_index(bulb),
+		color_array[current_color_index].color_name);
+
+	// Queued as Write Without Response, an older frame still waiting is replaced
+	err = color_queue_submit(&bulb->color_queue,
+				 bulb_profile_color(bulb->profile,
+						    color_array[current_color_index].color_value));
+	if (err) {
+		LOG_ERR("Color write of bulb %d rejected (err %d)", bulb_index(bulb), err);
+		central_stats_write_rejected(bulb_index(bulb));
+	} else {
+		latency_mark(bulb_index(bulb), LATENCY_FIRST_WRITE);
+	}
+
+	return err;
+}
+
+// Same WRGB colour on every ready bulb, queued together so they change in step
+static int broadcast_color(uint32_t wrgb)
+{
+	struct color_queue *qs[CONFIG_BT_MAX_CONN];
+	uint32_t colors[CONFIG_BT_MAX_CONN];
+	bool accepted[CONFIG_BT_MAX_CONN];
+	size_t count = 0;
+	int queued;
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		bulb_conn_t *bulb = &conn_table[i];
+
+		if (bulb->state == BULB_STATE_READY) {
+			qs[count] = &bulb->color_queue;
+			colors[count] = bulb_profile_color(bulb->profile, wrgb);
+			count++;
+		}
+	}
+
+	queued = color_sync_broadcast(qs, colors, count, accepted);
+
+	// Only the frames the queues took count as a first write
+	for (size_t i = 0; i < count; i++) {
+		if (!accepted[i]) {
+			continue;
+		}
+		latency_mark(bulb_index(CONTAINER_OF(qs[i], bulb_conn_t, color_queue)),
+			     LATENCY_FIRST_WRITE);
+	}
+
+	return queued;
+}
+
+static void set_color_all(void)
+{
+	int queued = broadcast_color(color_array[current_color_index].color_value);
+
+	LOG_INF("Setting color of %d bulb(s) to: %s", queued,
+		color_array[current_color_index].color_name);
+}
+
+// Completion hook of every colour queue, called once per write that went out
+static void color_written(struct color_queue *q)
+{
+	bulb_conn_t *bulb = CONTAINER_OF(q, bulb_conn_t, color_queue);
+	uint32_t done_cycles;
+	uint32_t done_gen;
+	uint32_t rx_cycles;
+	CENTRAL_TRACE("central_color_written", bt_conn_index(q->conn));
+
+	if (IS_ENABLED(CONFIG_APP_COLOR_SYNC)) {
+		color_sync_complete(q);
+	}
+
+	rx_cycles = atomic_clear(&bulb->host_cmd_cycles);
+	if (IS_ENABLED(CONFIG_APP_HOST_CMD) && rx_cycles) {
+		(void)color_queue_last_done(q, &done_gen, &done_cycles);
+		host_cmd_latency(rx_cycles, done_cycles);
+	}
+}
+
+// Write counters of the current link for "central stats"
+static bool link_writes(int slot, struct color_queue_stats *stats)
+{
+	bulb_conn_t *bulb = &conn_table[slot];
+
+	if (bulb->state != BULB_STATE_READY) {
+		return false;
+	}
+
+	color_queue_get_stats(&bulb->color_queue, stats);
+
+	return true;
+}
+
+static void host_cmd_apply(bulb_conn_t *bulb, const struct host_cmd *cmd)
+{
+	struct bt_le_conn_param param;
+	int err;
+
+	switch (cmd->opcode) {
+	case HOST_CMD_SET_COLOR:
+		// Stamped first, the write may complete before submit returns
+		atomic_set(&bulb->host_cmd_cycles, cmd->rx_cycles);
+		err = color_queue_submit(&bulb->color_queue,
+					 bulb_profile_color(bulb->profile, sys_get_le32(cmd->args)));
+		if (err) {
+			atomic_clear(&bulb->host_cmd_cycles);
+		}
+		break;
+
+	case HOST_CMD_READ_STATE:
+		(void)read_bulb_state(bulb);
+		break;
+
+	case HOST_CMD_CONN_PARAM:
+		param = (struct bt_le_conn_param)BT_LE_CONN_PARAM_INIT(
+			sys_get_le16(&cmd->args[0]), sys_get_le16(&cmd->args[0]),
+			sys_get_le16(&cmd->args[2]), sys_get_le16(&cmd->args[4]));
+		err = bt_conn_le_param_update(bulb->conn, &param);
+		if (err) {
+			LOG_WRN("Connection parameter update of bulb %d failed (err %d)",
+				bulb_index(bulb), err);
+		}
+		break;
+
+	case HOST_CMD_DISCONNECT:
+		LOG_INF("Disconnecting from bulb %d", bulb_index(bulb));
+		bulb_post(bulb, BULB_EVT_DISCONNECT);
+		break;
+
+	default:
+		break;
+	}
+}
+
+// Runs on bulb_workq for every command the host sent, like a button press would
+static void host_cmd_exec(const struct host_cmd *cmd)
+{
+	if (IS_ENABLED(CONFIG_APP_IDLE)) {
+		idle_policy_activity();
+	}
+
+	if (cmd->opcode == HOST_CMD_SET_COLOR && IS_ENABLED(CONFIG_APP_ANIM)) {
+		animation_stop();
+	}
+
+	if (cmd->peer != HOST_CMD_PEER_ALL) {
+		if (conn_table[cmd->peer].state != BULB_STATE_READY) {
+			LOG_WRN("Host command 0x%02x for bulb %u, which is not ready",
+				cmd->opcode, cmd->peer);
+			return;
+		}
+
+		host_cmd_apply(&conn_table[cmd->peer], cmd);
+		return;
+	}
+
+	if (cmd->opcode == HOST_CMD_SET_COLOR && IS_ENABLED(CONFIG_APP_COLOR_SYNC)) {
+		for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+			if (conn_table[i].state == BULB_STATE_READY) {
+				atomic_set(&conn_table[i].host_cmd_cycles, cmd->rx_cycles);
+			}
+		}
+
+		(void)broadcast_color(sys_get_le32(cmd->args));
+		return;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		if (conn_table[i].state == BULB_STATE_READY) {
+			host_cmd_apply(&conn_table[i], cmd);
+		}
+	}
+}
+
+// One animation frame to every ready bulb, each in its own wire format
+static void animation_output(uint32_t tick)
+{
+	size_t count = 0;
+	size_t slot = 0;
+
+	// A running animation keeps the links on their short interval
+	if (IS_ENABLED(CONFIG_APP_IDLE)) {
+		idle_policy_activity();
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		count += conn_table[i].state == BULB_STATE_READY;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		bulb_conn_t *bulb = &conn_table[i];
+
+		if (bulb->state != BULB_STATE_READY) {
+			continue;
+		}
+
+		// A frame still queued is replaced, a slow link just drops frames
+		(void)color_queue_submit(&bulb->color_queue,
+					 bulb_profile_color(bulb->profile,
+							    animation_frame(tick, slot++, count)));
+	}
+}
+
+static void color_report_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(color_report_work, color_report_handler);
+
+// Periodically print how many colour writes made it out per connection event
+static void color_report_handler(struct k_work *work)
+{
+	struct color_queue_stats stats;
+	struct bt_conn_info info;
+	uint32_t per_event;
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		bulb_conn_t *bulb = &conn_table[i];
+
+		if (bulb->state != BULB_STATE_READY) {
+			continue;
+		}
+
+		color_queue_get_stats(&bulb->color_queue, &stats);
+		if (!stats.window_completed || bt_conn_get_info(bulb->conn, &info)) {
+			continue;
+		}
+
+		per_event = color_queue_writes_per_event_x100(&stats, info.le.interval);
+
+		LOG_INF("Bulb %d colour writes: %u done, %u.%02u per connection event, "
+		       "%u coalesced, %u ENOMEM retries, %u failed",
+		       bulb_index(bulb), stats.window_completed, per_event / 100, per_event % 100,
+		       stats.coalesced, stats.no_mem, stats.failed);
+
+		color_queue_window_reset(&bulb->color_queue);
+	}
+
+	k_work_schedule(&color_report_work, K_SECONDS(CONFIG_APP_COLOR_QUEUE_REPORT_INTERVAL));
+}
+
+static int start_discovery(bulb_conn_t *bulb)
+{
+	int err;
+
+	// Discover the GATT database of the connected Peripheral in a single sweep
+	err = gatt_discovery_start(bulb->conn, &bulb->discovery, bulb->profile->chrcs,
+				   bulb->discovery_results, BULB_CHRC_COUNT, discovery_done);
+	if (err) {
+		LOG_ERR("Discovery failed (err %d)", err);
+		return err;
+	}
+
+	LOG_DBG("Discovery started on bulb %d", bulb_index(bulb));
+
+	return 0;
+}
+
+static uint8_t db_hash_read_func(struct bt_conn *conn, uint8_t err,
+				 struct bt_gatt_read_params *params,
+				 const void *data, uint16_t length)
+{
+	bulb_conn_t *bulb = CONTAINER_OF(params, bulb_conn_t, read_params);
+	struct gatt_cache_entry entry;
+	int ret;
+	CENTRAL_TRACE("central_db_hash", bt_conn_index(conn));
+
+	latency_mark(bulb_index(bulb), LATENCY_DB_HASH);
+	central_stats_discovery_ops(bulb_index(bulb), 1);
+
+	if (!err && data && length == GATT_DB_HASH_LEN) {
+		memcpy(bulb->db_hash, data, GATT_DB_HASH_LEN);
+		bulb->has_db_hash = true;
+	} else {
+		// Peer predates GATT caching (or the read failed), nothing to validate against
+		bulb->has_db_hash = false;
+	}
+
+	if (IS_ENABLED(CONFIG_APP_GATT_CACHE) &&
+	    gatt_cache_lookup(bt_conn_get_dst(conn), &entry) &&
+	    gatt_cache_entry_valid(&entry, bulb->has_db_hash ? bulb->db_hash : NULL)) {
+		LOG_INF("Using cached GATT handles for bulb %d", bulb_index(bulb));
+
+		bulb->handles_from_cache = true;
+		bulb->color_attr_handle = entry.color_attr_handle;
+		bulb->battery_level_value_handle = entry.battery_level_value_handle;
+		bulb->subscribe_params.value_handle = entry.battery_level_value_handle;
+		bulb->subscribe_params.ccc_handle = entry.battery_level_ccc_handle;
+
+		if (!bulb->profile->chrcs[BULB_CHRC_BATTERY_LEVEL].need_ccc) {
+			discovery_complete(bulb, 0);
+			return BT_GATT_ITER_STOP;
+		}
+
+		ret = subscribe_battery_level(bulb);
+		if (ret && !setup_retry(bulb, BULB_RETRY_SUBSCRIBE, ret)) {
+			discovery_complete(bulb, ret);
+		}
+		return BT_GATT_ITER_STOP;
+	}
+
+	ret = start_discovery(bulb);
+	if (ret && !setup_retry(bulb, BULB_RETRY_DISCOVERY, ret)) {
+		discovery_complete(bulb, ret);
+	}
+
+	return BT_GATT_ITER_STOP;
+}
+
+static int read_db_hash(bulb_conn_t *bulb)
+{
+	int err;
+
+	bulb->read_params.func = db_hash_read_func;
+	bulb->read_params.handle_count = 0;
+	bulb->read_params.by_uuid.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	bulb->read_params.by_uuid.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	bulb->read_params.by_uuid.uuid = BT_UUID_GATT_DB_HASH;
+
+	err = bt_gatt_read(bulb->conn, &bulb->read_params);
+	if (err) {
+		LOG_ERR("Database Hash read failed (err %d)", err);
+	}
+
+	return err;
+}
+
+// The scheduler let the bring-up of the link start, or resume with the step
+// that is being retried
+static int setup_issue(struct gatt_sched_op *op)
+{
+	bulb_conn_t *bulb = CONTAINER_OF(op, bulb_conn_t, setup_op);
+	bulb_retry_t step = bulb->retry_step;
+	int err;
+
+	// Set before the request, discovery_complete() may run before it returns
+	bulb->setup_slot = true;
+
+	switch (step) {
+	case BULB_RETRY_DISCOVERY:
+		err = start_discovery(bulb);
+		break;
+	case BULB_RETRY_SUBSCRIBE:
+		err = subscribe_battery_level(bulb);
+		break;
+	default:
+		// The Database Hash tells us whether previously cached handles can be
+		// reused. Without the cache we go straight to a full discovery.
+		step = BULB_RETRY_SETUP;
+		if (IS_ENABLED(CONFIG_APP_GATT_CACHE)) {
+			err = read_db_hash(bulb);
+		} else {
+			err = start_discovery(bulb);
+		}
+		break;
+	}
+	if (err) {
+		// The scheduler takes the slot back, a retry queues the op again
+		bulb->setup_slot = false;
+		if (!setup_retry(bulb, step, err)) {
+			discovery_complete(bulb, err);
+		}
+	}
+
+	return err;
+}
+
+// Connection state machine
+//
+// The BT callbacks only post events, bulb_sm_work_handler() feeds them through
+// bulb_transitions[] on bulb_workq. A handler runs the side effects of a
+// transition and returns the next state; entering a state (re)arms its timeout.
+
+typedef bulb_state_t (*bulb_handler_t)(bulb_conn_t *bulb);
+
+static bulb_state_t bulb_disconnect(bulb_conn_t *bulb)
+{
+	int err;
+
+	// The slot is released on BULB_EVT_DISCONNECTED, or by the timeout if that never comes
+	err = bt_conn_disconnect(bulb->conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+	if (err) {
+		LOG_ERR("Failed to disconnect (err %d)", err);
+	}
+
+	return BULB_STATE_DISCONNECTING;
+}
+
+static void bulb_release_link(bulb_conn_t *bulb)
+{
+	color_queue_reset(&bulb->color_queue);
+
+	if (bulb->conn) {
+		bt_conn_unref(bulb->conn);
+		bulb->conn = NULL;
+	}
+}
+
+#if defined(CONFIG_APP_FAST_RECONNECT)
+// A working link dropped: go straight back to the last known address with a
+// high duty cycle initiator instead of waiting for the name scan to find it.
+static bulb_state_t on_ready_link_lost(bulb_conn_t *bulb)
+{
+	const struct bt_conn_le_create_param create_param = {
+		.options = CONN_CREATE_OPTIONS,
+		.interval = CONFIG_APP_FAST_RECONNECT_SCAN_INTERVAL,
+		.window = CONFIG_APP_FAST_RECONNECT_SCAN_WINDOW,
+		// Units of 10 ms, the host reports a failed connection once it expires
+		.timeout = CONFIG_APP_FAST_RECONNECT_TIMEOUT_MS / 10,
+	};
+	const struct bulb_profile *profile = bulb->profile;
+	int8_t rssi = bulb->rssi;
+	// Kept so that leaving READY below logs the gap and FREE stops the series
+	bool battery_logged = bulb->battery_logged;
+	uint8_t battery_series = bulb->battery_series;
+	char addr_str[BT_ADDR_LE_STR_LEN];
+	bt_addr_le_t addr;
+	int err;
+
+	// An auto-connect from the filter accept list holds the initiator already
+	if (auto_connecting) {
+		return BULB_STATE_FREE;
+	}
+
+	bt_addr_le_copy(&addr, bt_conn_get_dst(bulb->conn));
+	bulb_release_link(bulb);
+	bulb_reset_link(bulb);
+	bulb->profile = profile;
+	bulb->rssi = rssi;
+	bulb->battery_logged = battery_logged;
+	bulb->battery_series = battery_series;
+	bulb->link_lost_at = k_uptime_get();
+
+	(void)stop_scan();
+	scan_accept_list = false;
+
+	latency_start(bulb_index(bulb), false);
+
+	err = bt_conn_le_create(&addr, &create_param, BT_LE_CONN_PARAM_DEFAULT, &bulb->conn);
+	if (err) {
+		bt_addr_le_to_str(&addr, addr_str, sizeof(addr_str));
+		LOG_ERR("Fast reconnect to %s failed to start (err %d)", addr_str, err);
+		reconnect_stats.fallbacks++;
+		return BULB_STATE_FREE;
+	}
+
+	return BULB_STATE_RECONNECTING;
+}
+#else
+static bulb_state_t on_ready_link_lost(bulb_conn_t *bulb)
+{
+	return BULB_STATE_FREE;
+}
+#endif /* CONFIG_APP_FAST_RECONNECT */
+
+static bulb_state_t on_reconnect_failed(bulb_conn_t *bulb)
+{
+	LOG_WRN("Fast reconnect of bulb %d gave up, back to scanning", bulb_index(bulb));
+	reconnect_stats.fallbacks++;
+
+	return BULB_STATE_FREE;
+}
+
+static void reconnect_restored(bulb_conn_t *bulb)
+{
+	uint32_t ms = (uint32_t)(k_uptime_get() - bulb->link_lost_at);
+
+	bulb->link_lost_at = 0;
+
+	reconnect_stats.last_ms = ms;
+	reconnect_stats.min_ms = reconnect_stats.restored ? MIN(reconnect_stats.min_ms, ms) : ms;
+	reconnect_stats.max_ms = MAX(reconnect_stats.max_ms, ms);
+	reconnect_stats.total_ms += ms;
+	reconnect_stats.restored++;
+
+	LOG_INF("Bulb %d restored %u ms after link loss (min %u avg %u max %u ms, "
+	       "%u restored, %u fell back to scanning)",
+	       bulb_index(bulb), ms, reconnect_stats.min_ms,
+	       (uint32_t)(reconnect_stats.total_ms / reconnect_stats.restored),
+	       reconnect_stats.max_ms, reconnect_stats.restored, reconnect_stats.fallbacks);
+}
+
+// The controller gave up on the connection: try the same address again if it
+// only ran short (e.g. of resources for one more link), scan otherwise
+static bulb_state_t on_connect_failed(bulb_conn_t *bulb)
+{
+	int delay;
+
+	if (!recovery_hci_transient(bulb->connect_err)) {
+		return BULB_STATE_FREE;
+	}
+
+	bulb->retry_step = BULB_RETRY_CONNECT;
+
+	delay = recovery_retry(&bulb->recovery, &bulb_workq);
+	if (delay < 0) {
+		return BULB_STATE_FREE;
+	}
+
+	LOG_WRN("Bulb %d: %s failed (err %u), retrying in %d ms", bulb_index(bulb),
+		bulb_retry_names[BULB_RETRY_CONNECT], bulb->connect_err, delay);
+
+	// Only the address is kept, the host refuses to connect to a peer that
+	// still has a connection object
+	bt_addr_le_copy(&bulb->retry_addr, bt_conn_get_dst(bulb->conn));
+	bt_conn_unref(bulb->conn);
+	bulb->conn = NULL;
+
+	return BULB_STATE_CONNECTING;
+}
+
+static bulb_state_t on_connect_retry(bulb_conn_t *bulb)
+{
+	char addr_str[BT_ADDR_LE_STR_LEN];
+	int err;
+
+	// Nothing to do unless a retry was scheduled for this link and is still due
+	if (bulb->retry_step != BULB_RETRY_CONNECT || bulb->conn ||
+	    bt_addr_le_eq(&bulb->retry_addr, BT_ADDR_LE_ANY)) {
+		return BULB_STATE_CONNECTING;
+	}
+
+	err = bt_conn_le_create(&bulb->retry_addr,
+				BT_CONN_LE_CREATE_PARAM(CONN_CREATE_OPTIONS, BT_GAP_SCAN_FAST_INTERVAL,
+							BT_GAP_SCAN_FAST_INTERVAL),
+				BT_LE_CONN_PARAM_DEFAULT, &bulb->conn);
+	if (!err) {
+		bt_addr_le_copy(&bulb->retry_addr, BT_ADDR_LE_ANY);
+		return BULB_STATE_CONNECTING;
+	}
+
+	// The initiator or a buffer was taken for now, the same address is tried again
+	if (setup_retry(bulb, BULB_RETRY_CONNECT, err)) {
+		return BULB_STATE_CONNECTING;
+	}
+
+	bt_addr_le_to_str(&bulb->retry_addr, addr_str, sizeof(addr_str));
+	LOG_ERR("Create conn to %s failed (%d)", addr_str, err);
+
+	return BULB_STATE_FREE;
+}
+
+static bulb_state_t on_connected(bulb_conn_t *bulb)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	// The bring-up steps get a fresh budget
+	recovery_reset(&bulb->recovery);
+	bulb->connected_ms = k_uptime_get_32();
+
+	bt_addr_le_to_str(bt_conn_get_dst(bulb->conn), addr, sizeof(addr));
+	LOG_INF("Connected: %s (bulb %d, %s)", addr, bulb_index(bulb), bulb->profile->name);
+
+	// Remember the bulb so it can be reconnected through the filter accept list
+	if (fleet_add(bt_conn_get_dst(bulb->conn), bulb_profile_id(bulb->profile)) < 0) {
+		LOG_WRN("Fleet registry full, %s not remembered", addr);
+	}
+
+	return BULB_STATE_CONNECTED;
+}
+
+static bulb_state_t on_remote_info(bulb_conn_t *bulb)
+{
+	int err;
+
+	LOG_DBG("Remote info from connected device available. We can now discover the GATT database");
+
+	// Negotiate PHY, data length, MTU and connection parameters alongside discovery
+	if (IS_ENABLED(CONFIG_APP_LINK_TUNING)) {
+		link_tuning_start(bulb->conn, bulb->rssi, NULL);
+	}
+
+	bulb->retry_step = BULB_RETRY_SETUP;
+	gatt_sched_op_init(&bulb->setup_op, GATT_SCHED_PRIO_SETUP, setup_issue);
+	err = gatt_sched_submit(&bulb->setup_op, bulb->conn);
+	if (err) {
+		return bulb_disconnect(bulb);
+	}
+
+	return BULB_STATE_DISCOVERING;
+}
+
+static bulb_state_t on_discovered(bulb_conn_t *bulb)
+{
+	recovery_reset(&bulb->recovery);
+
+	color_queue_init(&bulb->color_queue, bulb->conn, bulb->color_attr_handle, color_written);
+
+	LOG_INF("Discovered the characteristics of bulb %d.", bulb_index(bulb));
+
+	if (IS_ENABLED(CONFIG_APP_IDLE)) {
+		idle_policy_link_ready(bulb->conn);
+	}
+
+	// Not logged when the fleet registry was full
+	if (IS_ENABLED(CONFIG_APP_BATTERY_LOG)) {
+		int idx = fleet_find(bt_conn_get_dst(bulb->conn));
+
+		if (idx >= 0) {
+			bulb->battery_series = idx;
+			bulb->battery_logged = true;
+			battery_log_start(idx, bt_conn_get_dst(bulb->conn));
+		}
+	}
+
+	// Fast reconnects are not a bring-up from a scan
+	if (IS_ENABLED(CONFIG_APP_BENCH) && !bulb->link_lost_at) {
+		bench_bringup(bulb->connect_start_ms ? bulb->connected_ms - bulb->connect_start_ms : 0,
+			      k_uptime_get_32() - bulb->connected_ms);
+	}
+
+	if (bulb->link_lost_at) {
+		reconnect_restored(bulb);
+	}
+
+	// The first bulb to get ready is benchmarked, the others are left alone
+	if (IS_ENABLED(CONFIG_APP_BENCH)) {
+		(void)bench_start(bulb->conn, bulb->color_attr_handle,
+				  bulb->battery_level_value_handle);
+	}
+
+	// Bring-up time of the whole fleet, bulbs_ready() does not count this one yet
+	if (CONFIG_APP_FLEET_SIZE && !fleet_up && bulbs_ready() + 1 == CONFIG_APP_FLEET_SIZE) {
+		fleet_up = true;
+		LOG_INF("All %u bulbs of the fleet ready %u ms after boot", CONFIG_APP_FLEET_SIZE,
+			k_uptime_get_32());
 
-			k_sem_take(&sem_disconnected,  K_SECONDS(30));	
-			printk("Disconnected. Going back to scanning again...\n");
+		if (IS_ENABLED(CONFIG_APP_BENCH)) {
+			bench_fleet_ready(k_uptime_get_32());
 		}
 	}
-	
+
+	return BULB_STATE_READY;
+}
+
+// Repeat the bring-up step that failed once the scheduler has a slot again,
+// the discovery timeout still bounds the whole
+static bulb_state_t on_setup_retry(bulb_conn_t *bulb)
+{
+	int err;
+
+	// A connection retry that was due before the link came up
+	if (bulb->retry_step == BULB_RETRY_CONNECT || !bulb->conn) {
+		return BULB_STATE_DISCOVERING;
+	}
+
+	err = gatt_sched_submit(&bulb->setup_op, bulb->conn);
+	if (err) {
+		LOG_DBG("Bulb %d: %s retry already queued", bulb_index(bulb),
+			bulb_retry_names[bulb->retry_step]);
+	}
+
+	return BULB_STATE_DISCOVERING;
+}
+
+static bulb_state_t on_discovery_failed(bulb_conn_t *bulb)
+{
+	LOG_ERR("GATT discovery failed (err %d)", bulb->discovery_err);
+
+	return bulb_disconnect(bulb);
+}
+
+static bulb_state_t on_timeout(bulb_conn_t *bulb)
+{
+	LOG_WRN("Timed out during GATT discovery of bulb %d", bulb_index(bulb));
+
+	return bulb_disconnect(bulb);
+}
+
+static bulb_state_t on_disconnect_timeout(bulb_conn_t *bulb)
+{
+	LOG_WRN("Bulb %d did not disconnect in time, releasing its slot", bulb_index(bulb));
+
+	return BULB_STATE_FREE;
+}
+
+static bulb_state_t on_link_lost(bulb_conn_t *bulb)
+{
+	return BULB_STATE_FREE;
+}
+
+// NULL: the event is meaningless in that state (e.g. a late timeout) and is dropped
+static const bulb_handler_t bulb_transitions[BULB_STATE_COUNT][BULB_EVT_COUNT] = {
+	[BULB_STATE_CONNECTING] = {
+		[BULB_EVT_CONNECTED] = on_connected,
+		[BULB_EVT_CONNECT_FAILED] = on_connect_failed,
+		[BULB_EVT_RETRY] = on_connect_retry,
+		[BULB_EVT_DISCONNECTED] = on_link_lost,
+	},
+	[BULB_STATE_RECONNECTING] = {
+		[BULB_EVT_CONNECTED] = on_connected,
+		[BULB_EVT_CONNECT_FAILED] = on_reconnect_failed,
+		[BULB_EVT_DISCONNECTED] = on_reconnect_failed,
+	},
+	[BULB_STATE_CONNECTED] = {
+		[BULB_EVT_REMOTE_INFO] = on_remote_info,
+		[BULB_EVT_TIMEOUT] = on_timeout,
+		[BULB_EVT_DISCONNECT] = bulb_disconnect,
+		[BULB_EVT_DISCONNECTED] = on_link_lost,
+	},
+	[BULB_STATE_DISCOVERING] = {
+		[BULB_EVT_DISCOVERED] = on_discovered,
+		[BULB_EVT_DISCOVERY_FAILED] = on_discovery_failed,
+		[BULB_EVT_RETRY] = on_setup_retry,
+		[BULB_EVT_TIMEOUT] = on_timeout,
+		[BULB_EVT_DISCONNECT] = bulb_disconnect,
+		[BULB_EVT_DISCONNECTED] = on_link_lost,
+	},
+	[BULB_STATE_READY] = {
+		[BULB_EVT_DISCONNECT] = bulb_disconnect,
+		[BULB_EVT_DISCONNECTED] = on_ready_link_lost,
+	},
+	[BULB_STATE_DISCONNECTING] = {
+		[BULB_EVT_TIMEOUT] = on_disconnect_timeout,
+		[BULB_EVT_DISCONNECTED] = on_link_lost,
+	},
+};
+
+static const struct {
+	const char *name;
+	// 0: no timeout. Connection creation is bounded by the host through the create timeout.
+	uint32_t timeout_s;
+} bulb_states[BULB_STATE_COUNT] = {
+	[BULB_STATE_FREE] = { "free", 0 },
+	[BULB_STATE_CONNECTING] = { "connecting", 0 },
+	[BULB_STATE_RECONNECTING] = { "reconnecting", 0 },
+	[BULB_STATE_CONNECTED] = { "connected", CONFIG_APP_DISCOVERY_TIMEOUT },
+	[BULB_STATE_DISCOVERING] = { "discovering", CONFIG_APP_DISCOVERY_TIMEOUT },
+	[BULB_STATE_READY] = { "ready", 0 },
+	[BULB_STATE_DISCONNECTING] = { "disconnecting", CONFIG_APP_DISCONNECT_TIMEOUT },
+};
+
+static void bulb_enter(bulb_conn_t *bulb, bulb_state_t from, bulb_state_t to)
+{
+	LOG_DBG("Bulb %d: %s -> %s", bulb_index(bulb), bulb_states[from].name, bulb_states[to].name);
+
+	if (bulb_states[to].timeout_s) {
+		(void)k_work_reschedule_for_queue(&bulb_workq, &bulb->timeout_work,
+						  K_SECONDS(bulb_states[to].timeout_s));
+	} else {
+		(void)k_work_cancel_delayable(&bulb->timeout_work);
+	}
+
+	if (to == BULB_STATE_FREE) {
+		// A retry still pending belongs to the link that is gone
+		recovery_reset(&bulb->recovery);
+		bulb_release_link(bulb);
+	}
+
+	// Samples taken without a link are logged as unknown
+	if (IS_ENABLED(CONFIG_APP_BATTERY_LOG) && bulb->battery_logged && from == BULB_STATE_READY) {
+		battery_log_update(bulb->battery_series, BATTERY_LOG_UNKNOWN);
+	}
+	if (IS_ENABLED(CONFIG_APP_BATTERY_LOG) && bulb->battery_logged && to == BULB_STATE_FREE) {
+		battery_log_stop(bulb->battery_series);
+		bulb->battery_logged = false;
+	}
+
+	// Last, the slot may be reallocated from the BT callbacks as soon as it reads FREE
+	bulb->state = to;
+
+	// A link came up or a slot was released: look for more bulbs
+	if ((to == BULB_STATE_CONNECTED && !connect_next_heard()) || to == BULB_STATE_FREE) {
+		start_scan();
+	}
+}
+
+static void bulb_sm_work_handler(struct k_work *work)
+{
+	bulb_conn_t *bulb = CONTAINER_OF(work, bulb_conn_t, sm_work);
+	atomic_val_t events = atomic_clear(&bulb->events);
+	bulb_handler_t handler;
+	bulb_state_t state;
+	bulb_state_t next;
+
+	// Events are handled in lifecycle order, so a disconnect always comes last
+	for (bulb_event_t evt = 0; evt < BULB_EVT_COUNT && bulb->state != BULB_STATE_FREE; evt++) {
+		if (!(events & BIT(evt))) {
+			continue;
+		}
+
+		state = bulb->state;
+		handler = bulb_transitions[state][evt];
+		if (!handler) {
+			continue;
+		}
+
+		// A transition to or from CONNECTING is atomic to connect_bulb()
+		(void)k_mutex_lock(&scan_lock, K_FOREVER);
+		next = handler(bulb);
+		if (next != state) {
+			bulb_enter(bulb, state, next);
+		}
+		(void)k_mutex_unlock(&scan_lock);
+	}
+}
+
+static void bulb_timeout_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	bulb_conn_t *bulb = CONTAINER_OF(dwork, bulb_conn_t, timeout_work);
+
+	bulb_post(bulb, BULB_EVT_TIMEOUT);
+}
+
+static void bulb_retry_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	bulb_conn_t *bulb = CONTAINER_OF(dwork, bulb_conn_t, recovery.work);
+
+	bulb_post(bulb, BULB_EVT_RETRY);
+}
+
+static void idle_changed(bool idle)
+{
+	(void)k_mutex_lock(&scan_lock, K_FOREVER);
+	if (!idle) {
+		start_scan();
+	} else if (scan_running && scan_parked()) {
+		LOG_INF("Every known bulb is connected and idle, scan parked");
+		(void)stop_scan();
+	}
+	(void)k_mutex_unlock(&scan_lock);
+}
+
+// Radio share of the running scan for the idle policy's duty cycle estimate
+static uint32_t scan_permille(void)
+{
+	const struct bt_le_scan_param *param = NULL;
+	bool fast;
+
+	(void)k_mutex_lock(&scan_lock, K_FOREVER);
+	fast = auto_connecting || scan_accept_list;
+	if (scan_running) {
+		param = scan_duty_param(scan_level);
+	}
+	(void)k_mutex_unlock(&scan_lock);
+
+	if (fast) {
+		return (BT_GAP_SCAN_FAST_WINDOW * 1000U) / BT_GAP_SCAN_FAST_INTERVAL;
+	}
+
+	if (!param) {
+		return 0;
+	}
+
+	return (param->window * 1000U) / param->interval;
+}
+
+// One battery series per event frame on the host link
+static int battery_export(uint8_t index, const uint8_t *data, size_t len)
+{
+	return host_cmd_event(HOST_EVT_BATTERY, index, data, len);
+}
+
+static const struct idle_policy_cb idle_callbacks = {
+	.changed = idle_changed,
+	.scan_permille = scan_permille,
+};
+
+static void bulb_sm_init(void)
+{
+	const struct k_work_queue_config cfg = { .name = "bulb_sm" };
+
+	for (size_t i = 0; i < ARRAY_SIZE(conn_table); i++) {
+		k_work_init(&conn_table[i].sm_work, bulb_sm_work_handler);
+		k_work_init_delayable(&conn_table[i].timeout_work, bulb_timeout_handler);
+		recovery_init(&conn_table[i].recovery, bulb_retry_handler);
+	}
+
+	k_work_queue_init(&bulb_workq);
+	k_work_queue_start(&bulb_workq, bulb_workq_stack, K_THREAD_STACK_SIZEOF(bulb_workq_stack),
+			   CONFIG_APP_CONN_SM_PRIORITY, &cfg);
+}
+
+int main(void)
+{
+	int err;
+
+	bulb_sm_init();
+	notify_ring_start(notify_batch_handler);
+	central_stats_init(link_writes);
+
+	// Frames are written from bulb_workq, next to the state machine that owns the links
+	if (IS_ENABLED(CONFIG_APP_ANIM)) {
+		animation_init(&bulb_workq, animation_output);
+	}
+
+	if (IS_ENABLED(CONFIG_APP_LINK_TUNING)) {
+		link_tuning_init();
+	}
+
+	err = init_buttons();
+	if (err) {
+		LOG_ERR("Cannot init buttons (err: %d)", err);
+		return 0;
+	}
+
+	err = bt_enable(NULL);
+	if (err) {
+		LOG_ERR("Bluetooth init failed (err %d)", err);
+		return 0;
+	}
+
+	LOG_INF("Bluetooth initialized");
+
+	(void)bt_le_scan_cb_register(&scan_callbacks);
+
+	// Evaluated on bulb_workq, which also restarts the scan when leaving idle
+	if (IS_ENABLED(CONFIG_APP_IDLE)) {
+		idle_policy_init(&bulb_workq, &idle_callbacks);
+	}
+
+	// Host commands run on bulb_workq, interleaved with the link state machines
+	if (IS_ENABLED(CONFIG_APP_HOST_CMD)) {
+		err = host_cmd_init(&bulb_workq, host_cmd_exec);
+		if (err) {
+			LOG_WRN("Host command link not available (err %d)", err);
+		}
+	}
+
+	// Sampled and exported on bulb_workq too, next to the state machine that starts the series
+	if (IS_ENABLED(CONFIG_APP_BATTERY_LOG)) {
+		battery_log_init(&bulb_workq, battery_export);
+	}
+
+	// Restores the persisted GATT handle cache among others
+	if (IS_ENABLED(CONFIG_SETTINGS)) {
+		settings_load();
+	}
+
+	if (CONFIG_APP_COLOR_QUEUE_REPORT_INTERVAL > 0) {
+		k_work_schedule(&color_report_work, K_SECONDS(CONFIG_APP_COLOR_QUEUE_REPORT_INTERVAL));
+	}
+
+	// Scanning keeps running in the background while there are free connection slots.
+	// From here on everything is driven by the BT callbacks and bulb_workq.
+	start_scan();
+
+#if defined(CONFIG_APP_SCAN_ADAPTIVE)
+	(void)k_work_schedule_for_queue(&bulb_workq, &scan_adapt_work,
+				       K_MSEC(CONFIG_APP_SCAN_ADAPT_PERIOD_MS));
+#endif
+
 	return 0;
 }
@@ -0,0 +1,105 @@
+/* notify_ring.c - Notification ring buffer drained by a consumer thread */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "notify_ring.h"
+
+LOG_MODULE_REGISTER(notify_ring, CONFIG_APP_NOTIFY_RING_LOG_LEVEL);
+
+#define RING_SIZE CONFIG_APP_NOTIFY_RING_SIZE
+
+BUILD_ASSERT(IS_POWER_OF_TWO(RING_SIZE), "ring size must be a power of two");
+
+// Single producer (BT RX), single consumer (notify thread). head is only
+// written by the producer and tail only by the consumer, both free running.
+static struct notify_event ring[RING_SIZE];
+static atomic_t head;
+static atomic_t tail;
+static atomic_t dropped;
+
+static K_SEM_DEFINE(ring_sem, 0, 1);
+static K_THREAD_STACK_DEFINE(consumer_stack, CONFIG_APP_NOTIFY_THREAD_STACK_SIZE);
+static struct k_thread consumer_thread;
+static notify_ring_handler_t ring_handler;
+
+int notify_ring_push(struct bt_conn *conn, uint16_t handle, const void *data, uint16_t len)
+{
+	atomic_val_t h = atomic_get(&head);
+	struct notify_event *evt;
+
+	if ((atomic_val_t)(h - atomic_get(&tail)) >= RING_SIZE) {
+		atomic_inc(&dropped);
+		return -ENOMEM;
+	}
+
+	evt = &ring[h & (RING_SIZE - 1)];
+	evt->conn = bt_conn_ref(conn);
+	evt->handle = handle;
+	evt->len = len;
+	evt->timestamp = k_cycle_get_32();
+	memcpy(evt->value, data, MIN(len, sizeof(evt->value)));
+
+	// Publish the entry only once it is complete
+	atomic_set(&head, h + 1);
+	k_sem_give(&ring_sem);
+
+	return 0;
+}
+
+uint32_t notify_ring_dropped(void)
+{
+	return atomic_get(&dropped);
+}
+
+static void consumer(void *p1, void *p2, void *p3)
+{
+	struct notify_event batch[CONFIG_APP_NOTIFY_BATCH];
+	uint32_t reported_drops = 0;
+	uint32_t drops;
+	atomic_val_t t;
+	size_t count;
+
+	while (1) {
+		k_sem_take(&ring_sem, K_FOREVER);
+
+		t = atomic_get(&tail);
+
+		while (t != atomic_get(&head)) {
+			// Copy out and free the slots first, the producer can go on meanwhile
+			for (count = 0; count < ARRAY_SIZE(batch) && t != atomic_get(&head); count++, t++) {
+				batch[count] = ring[t & (RING_SIZE - 1)];
+			}
+			atomic_set(&tail, t);
+
+			ring_handler(batch, count);
+
+			for (size_t i = 0; i < count; i++) {
+				bt_conn_unref(batch[i].conn);
+			}
+		}
+
+		drops = atomic_get(&dropped);
+		if (drops != reported_drops) {
+			LOG_WRN("%u notification(s) dropped, ring full (%u total)",
+				drops - reported_drops, drops);
+			reported_drops = drops;
+		}
+	}
+}
+
+void notify_ring_start(notify_ring_handler_t handler)
+{
+	ring_handler = handler;
+
+	k_thread_create(&consumer_thread, consumer_stack, K_THREAD_STACK_SIZEOF(consumer_stack),
+			consumer, NULL, NULL, NULL, CONFIG_APP_NOTIFY_THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&consumer_thread, "notify");
+}
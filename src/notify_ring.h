@@ -0,0 +1,37 @@
+/* notify_ring.h - Notification ring buffer drained by a consumer thread */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef NOTIFY_RING_H_
+#define NOTIFY_RING_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/conn.h>
+
+struct notify_event {
+	// Referenced by the ring, released after the batch was processed
+	struct bt_conn *conn;
+	uint16_t handle;
+	// Length received; value holds at most CONFIG_APP_NOTIFY_VALUE_MAX of it
+	uint16_t len;
+	uint32_t timestamp;
+	uint8_t value[CONFIG_APP_NOTIFY_VALUE_MAX];
+};
+
+// Called from the consumer thread with up to CONFIG_APP_NOTIFY_BATCH events
+typedef void (*notify_ring_handler_t)(const struct notify_event *evts, size_t count);
+
+// Start the consumer thread
+void notify_ring_start(notify_ring_handler_t handler);
+
+// Queue a notification in constant time. Single producer: only call this
+// from the BT RX thread (i.e. notify callbacks). Returns -ENOMEM and counts
+// a drop when the ring is full.
+int notify_ring_push(struct bt_conn *conn, uint16_t handle, const void *data, uint16_t len);
+
+// Notifications dropped because the ring was full
+uint32_t notify_ring_dropped(void);
+
+#endif /* NOTIFY_RING_H_ */
@@ -0,0 +1,71 @@
+/* recovery.c - Retry transient bring-up failures with exponential backoff */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/random/random.h>
+#include <zephyr/bluetooth/att.h>
+#include <zephyr/bluetooth/hci.h>
+
+#include "recovery.h"
+
+BUILD_ASSERT(CONFIG_APP_RECOVERY_MAX_MS >= CONFIG_APP_RECOVERY_BASE_MS,
+	     "backoff cap below the first delay");
+
+void recovery_init(struct recovery *r, k_work_handler_t handler)
+{
+	k_work_init_delayable(&r->work, handler);
+	r->attempts = 0;
+}
+
+bool recovery_transient(int err)
+{
+	switch (err) {
+	// Out of host buffers or another procedure running, both clear up shortly
+	case -ENOMEM:
+	case -EBUSY:
+	case -EAGAIN:
+	// The peer ran out of resources for the request
+	case BT_ATT_ERR_INSUFFICIENT_RESOURCES:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool recovery_hci_transient(uint8_t reason)
+{
+	// Usually a missed CONNECT_IND or first connection event, not a peer that refuses
+	return reason == BT_HCI_ERR_CONN_FAIL_TO_ESTAB ||
+	       reason == BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+}
+
+int recovery_retry(struct recovery *r, struct k_work_q *queue)
+{
+	uint32_t delay_ms;
+
+	if (r->attempts >= CONFIG_APP_RECOVERY_ATTEMPTS) {
+		return -EAGAIN;
+	}
+
+	delay_ms = MIN((uint32_t)CONFIG_APP_RECOVERY_BASE_MS << MIN(r->attempts, 16U),
+		       (uint32_t)CONFIG_APP_RECOVERY_MAX_MS);
+	r->attempts++;
+
+	// Links that failed together do not all come back in the same connection event
+	delay_ms -= sys_rand32_get() % (delay_ms / 2U + 1U);
+
+	(void)k_work_schedule_for_queue(queue, &r->work, K_MSEC(delay_ms));
+
+	return delay_ms;
+}
+
+void recovery_reset(struct recovery *r)
+{
+	(void)k_work_cancel_delayable(&r->work);
+	r->attempts = 0;
+}
@@ -0,0 +1,52 @@
+/* recovery.h - Retry transient bring-up failures with exponential backoff */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef RECOVERY_H_
+#define RECOVERY_H_
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+
+// Retry budget of one link, embedded by the owner
+struct recovery {
+	struct k_work_delayable work;
+	uint8_t attempts;
+};
+
+#if defined(CONFIG_APP_RECOVERY)
+
+// handler runs once the backoff of a scheduled retry expired
+void recovery_init(struct recovery *r, k_work_handler_t handler);
+
+// A GATT step failed with err, a negative errno from the API call or an ATT
+// error code from the response. Transient errors are worth retrying.
+bool recovery_transient(int err);
+
+// A connection failed to be established for reason (HCI error code)
+bool recovery_hci_transient(uint8_t reason);
+
+// Schedule the handler on queue after CONFIG_APP_RECOVERY_BASE_MS doubled
+// with every attempt, capped at CONFIG_APP_RECOVERY_MAX_MS, minus up to half
+// of it as jitter. Returns the delay in ms, or -EAGAIN once
+// CONFIG_APP_RECOVERY_ATTEMPTS retries were scheduled since the last reset:
+// time to escalate.
+int recovery_retry(struct recovery *r, struct k_work_q *queue);
+
+// Link gone or brought up: cancel a pending retry and restore the budget
+void recovery_reset(struct recovery *r);
+
+#else
+
+static inline void recovery_init(struct recovery *r, k_work_handler_t handler) {}
+static inline bool recovery_transient(int err) { return false; }
+static inline bool recovery_hci_transient(uint8_t reason) { return false; }
+static inline int recovery_retry(struct recovery *r, struct k_work_q *queue) { return -EAGAIN; }
+static inline void recovery_reset(struct recovery *r) {}
+
+#endif /* CONFIG_APP_RECOVERY */
+
+#endif /* RECOVERY_H_ */
@@ -0,0 +1,194 @@
+/* scan_cache.c - Bounded scan report cache with RSSI aggregation */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "scan_cache.h"
+
+#define BUCKETS CONFIG_APP_SCAN_CACHE_BUCKETS
+#define WAYS    CONFIG_APP_SCAN_CACHE_WAYS
+
+BUILD_ASSERT(IS_POWER_OF_TWO(BUCKETS), "bucket count must be a power of two");
+
+// Set associative: an address hashes to one bucket of WAYS entries, and the
+// least recently seen entry of that bucket is evicted when it is full.
+static struct scan_cache_entry cache[BUCKETS][WAYS];
+static struct k_spinlock lock;
+
+static uint32_t addr_hash(const bt_addr_le_t *addr)
+{
+	// FNV-1a over type and address
+	uint32_t hash = 2166136261U;
+
+	hash = (hash ^ addr->type) * 16777619U;
+	for (size_t i = 0; i < sizeof(addr->a.val); i++) {
+		hash = (hash ^ addr->a.val[i]) * 16777619U;
+	}
+
+	return hash;
+}
+
+static struct scan_cache_entry *lookup_or_evict(const bt_addr_le_t *addr, bool *found)
+{
+	struct scan_cache_entry *bucket = cache[addr_hash(addr) & (BUCKETS - 1)];
+	struct scan_cache_entry *victim = &bucket[0];
+
+	for (size_t i = 0; i < WAYS; i++) {
+		struct scan_cache_entry *entry = &bucket[i];
+
+		if (entry->in_use && bt_addr_le_eq(&entry->addr, addr)) {
+			*found = true;
+			return entry;
+		}
+
+		if (!entry->in_use) {
+			victim = entry;
+		} else if (victim->in_use &&
+			   (int32_t)(entry->last_seen - victim->last_seen) < 0) {
+			victim = entry;
+		}
+	}
+
+	*found = false;
+	return victim;
+}
+
+void scan_cache_update(const bt_addr_le_t *addr, int8_t rssi, struct scan_cache_entry *copy,
+		       bool *duplicate)
+{
+	uint32_t now = k_uptime_get_32();
+	struct scan_cache_entry *entry;
+	k_spinlock_key_t key;
+	bool found;
+
+	key = k_spin_lock(&lock);
+
+	entry = lookup_or_evict(addr, &found);
+	if (!found) {
+		(void)memset(entry, 0, sizeof(*entry));
+		bt_addr_le_copy(&entry->addr, addr);
+		entry->in_use = true;
+		entry->rssi_min = rssi;
+		entry->rssi_max = rssi;
+	}
+
+	// Keep the average meaningful without overflowing
+	if (entry->rssi_count == UINT16_MAX) {
+		entry->rssi_sum /= 2;
+		entry->rssi_count /= 2;
+	}
+
+	entry->rssi_sum += rssi;
+	entry->rssi_count++;
+	entry->rssi_min = MIN(entry->rssi_min, rssi);
+	entry->rssi_max = MAX(entry->rssi_max, rssi);
+	entry->last_seen = now;
+
+	*duplicate = found && entry->last_processed &&
+		     (now - entry->last_processed) < CONFIG_APP_SCAN_DEDUP_WINDOW_MS;
+	*copy = *entry;
+
+	k_spin_unlock(&lock, key);
+}
+
+void scan_cache_reject(const bt_addr_le_t *addr)
+{
+	struct scan_cache_entry *entry;
+	k_spinlock_key_t key;
+	bool found;
+
+	key = k_spin_lock(&lock);
+
+	// Evicted in the meantime, the next report starts over
+	entry = lookup_or_evict(addr, &found);
+	if (found) {
+		entry->rejected = true;
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+void scan_cache_matched(const bt_addr_le_t *addr, uint8_t profile)
+{
+	struct scan_cache_entry *entry;
+	k_spinlock_key_t key;
+	bool found;
+
+	key = k_spin_lock(&lock);
+
+	entry = lookup_or_evict(addr, &found);
+	if (found) {
+		entry->matched = true;
+		entry->profile = profile;
+		// 0 means "never", so an uptime of exactly 0 ms is rounded up
+		entry->last_processed = MAX(entry->last_seen, 1U);
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+int8_t scan_cache_rssi_avg(const struct scan_cache_entry *entry)
+{
+	if (!entry->rssi_count) {
+		return 0;
+	}
+
+	return entry->rssi_sum / entry->rssi_count;
+}
+
+static bool is_connected(const bt_addr_le_t *addr)
+{
+	struct bt_conn *conn;
+
+	conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+	if (!conn) {
+		return false;
+	}
+
+	bt_conn_unref(conn);
+
+	return true;
+}
+
+bool scan_cache_best_candidate(uint32_t max_age_ms, struct scan_cache_entry *best)
+{
+	uint32_t now = k_uptime_get_32();
+	struct scan_cache_entry candidate;
+	bool have_best = false;
+	k_spinlock_key_t key;
+
+	for (size_t b = 0; b < BUCKETS; b++) {
+		for (size_t w = 0; w < WAYS; w++) {
+			key = k_spin_lock(&lock);
+			candidate = cache[b][w];
+			k_spin_unlock(&lock, key);
+
+			if (!candidate.in_use || !candidate.matched ||
+			    (now - candidate.last_seen) > max_age_ms) {
+				continue;
+			}
+
+			if (have_best &&
+			    scan_cache_rssi_avg(&candidate) <= scan_cache_rssi_avg(best)) {
+				continue;
+			}
+
+			// Checked last, it is the most expensive test
+			if (is_connected(&candidate.addr)) {
+				continue;
+			}
+
+			*best = candidate;
+			have_best = true;
+		}
+	}
+
+	return have_best;
+}
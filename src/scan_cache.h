@@ -0,0 +1,50 @@
+/* scan_cache.h - Bounded scan report cache with RSSI aggregation */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SCAN_CACHE_H_
+#define SCAN_CACHE_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/addr.h>
+
+struct scan_cache_entry {
+	bt_addr_le_t addr;
+	bool in_use;
+	// Advertisement matched the bulb rules, profile holds the bulb_profile id
+	bool matched;
+	uint8_t profile;
+	// A scan response without a match was seen, the device is not a bulb
+	bool rejected;
+	int8_t rssi_min;
+	int8_t rssi_max;
+	uint16_t rssi_count;
+	int32_t rssi_sum;
+	// k_uptime_get_32() of the last report and of the last one passed on
+	uint32_t last_seen;
+	uint32_t last_processed;
+};
+
+// Record a report from addr and fold rssi into its statistics, evicting the
+// least recently seen entry of the bucket if needed. A copy of the updated
+// entry is left in *entry. *duplicate is set when the address was already
+// processed within CONFIG_APP_SCAN_DEDUP_WINDOW_MS, in which case the caller
+// should skip it.
+void scan_cache_update(const bt_addr_le_t *addr, int8_t rssi, struct scan_cache_entry *entry,
+		       bool *duplicate);
+
+// addr is not a bulb, its reports are skipped from now on
+void scan_cache_reject(const bt_addr_le_t *addr);
+
+// addr matched profile and was processed now (restarts its deduplication window)
+void scan_cache_matched(const bt_addr_le_t *addr, uint8_t profile);
+
+int8_t scan_cache_rssi_avg(const struct scan_cache_entry *entry);
+
+// Copy out the matched, not yet connected entry with the strongest average
+// RSSI that was seen within the last max_age_ms. Returns false if none.
+bool scan_cache_best_candidate(uint32_t max_age_ms, struct scan_cache_entry *best);
+
+#endif /* SCAN_CACHE_H_ */
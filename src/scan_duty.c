@@ -0,0 +1,113 @@
+/* scan_duty.c - Adaptive scan duty cycle */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "scan_duty.h"
+
+// Coded PHY is scanned alongside 1M, with the same interval and window
+#define SCAN_OPTIONS \
+	(BT_LE_SCAN_OPT_FILTER_DUPLICATE | \
+	 (IS_ENABLED(CONFIG_APP_SCAN_CODED) ? BT_LE_SCAN_OPT_CODED : 0))
+
+#define SCAN_TYPE_SLOW \
+	(IS_ENABLED(CONFIG_APP_SCAN_SLOW_PASSIVE) ? BT_LE_SCAN_TYPE_PASSIVE : BT_LE_SCAN_TYPE_ACTIVE)
+
+static const struct {
+	const char *name;
+	struct bt_le_scan_param param;
+} levels[SCAN_DUTY_COUNT] = {
+	// 30 ms every 60 ms
+	[SCAN_DUTY_FAST] = { "fast", BT_LE_SCAN_PARAM_INIT(BT_LE_SCAN_TYPE_ACTIVE, SCAN_OPTIONS,
+							   BT_GAP_SCAN_FAST_INTERVAL,
+							   BT_GAP_SCAN_FAST_WINDOW) },
+	// 30 ms every 200 ms
+	[SCAN_DUTY_MEDIUM] = { "medium", BT_LE_SCAN_PARAM_INIT(BT_LE_SCAN_TYPE_ACTIVE, SCAN_OPTIONS,
+							       0x0140, BT_GAP_SCAN_FAST_WINDOW) },
+	// 11.25 ms every 1.28 s
+	[SCAN_DUTY_SLOW] = { "slow", BT_LE_SCAN_PARAM_INIT(SCAN_TYPE_SLOW, SCAN_OPTIONS,
+							   BT_GAP_SCAN_SLOW_INTERVAL_1,
+							   BT_GAP_SCAN_SLOW_WINDOW_1) },
+};
+
+#if defined(CONFIG_APP_SCAN_ADAPTIVE)
+// k_uptime_get_32() of the last match, boot counts as one
+static atomic_t last_hit;
+
+void scan_duty_hit(void)
+{
+	atomic_set(&last_hit, k_uptime_get_32());
+}
+
+static void add_link_load(struct bt_conn *conn, void *data)
+{
+	uint32_t *load = data;
+	struct bt_conn_info info;
+
+	if (bt_conn_get_info(conn, &info) || info.state != BT_CONN_STATE_CONNECTED ||
+	    !info.le.interval) {
+		return;
+	}
+
+	// Interval in 1.25 ms units
+	*load += (CONFIG_APP_SCAN_CONN_EVENT_US * 1000U) / (info.le.interval * 1250U);
+}
+
+uint32_t scan_duty_link_load(void)
+{
+	uint32_t load = 0;
+
+	bt_conn_foreach(BT_CONN_TYPE_LE, add_link_load, &load);
+
+	return MIN(load, 1000U);
+}
+
+enum scan_duty_level scan_duty_select(size_t missing)
+{
+	uint32_t idle_ms;
+	uint32_t level;
+
+	if (missing) {
+		level = SCAN_DUTY_FAST;
+	} else {
+		idle_ms = k_uptime_get_32() - (uint32_t)atomic_get(&last_hit);
+		level = idle_ms / CONFIG_APP_SCAN_IDLE_MS;
+	}
+
+	// Leave the radio to the links, one step down per CONFIG_APP_SCAN_BUSY_PERMILLE of load
+	level += scan_duty_link_load() / CONFIG_APP_SCAN_BUSY_PERMILLE;
+
+	return MIN(level, SCAN_DUTY_SLOW);
+}
+#else
+void scan_duty_hit(void)
+{
+}
+
+uint32_t scan_duty_link_load(void)
+{
+	return 0;
+}
+
+// Always at full duty
+enum scan_duty_level scan_duty_select(size_t missing)
+{
+	return SCAN_DUTY_FAST;
+}
+#endif /* CONFIG_APP_SCAN_ADAPTIVE */
+
+const struct bt_le_scan_param *scan_duty_param(enum scan_duty_level level)
+{
+	return &levels[level].param;
+}
+
+const char *scan_duty_name(enum scan_duty_level level)
+{
+	return levels[level].name;
+}
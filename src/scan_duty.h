@@ -0,0 +1,38 @@
+/* scan_duty.h - Adaptive scan duty cycle */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SCAN_DUTY_H_
+#define SCAN_DUTY_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+// From the highest to the lowest duty cycle
+enum scan_duty_level {
+	SCAN_DUTY_FAST,
+	SCAN_DUTY_MEDIUM,
+	SCAN_DUTY_SLOW,
+	SCAN_DUTY_COUNT
+};
+
+// A scan report matched the bulb rules
+void scan_duty_hit(void);
+
+// Pick the level for the name based scan. missing is the number of bulbs
+// known to be absent: any of them keeps the scan fast. Otherwise the level
+// steps down every CONFIG_APP_SCAN_IDLE_MS without a match. Either way it is
+// lowered further while connection events occupy the radio.
+enum scan_duty_level scan_duty_select(size_t missing);
+
+const struct bt_le_scan_param *scan_duty_param(enum scan_duty_level level);
+
+const char *scan_duty_name(enum scan_duty_level level);
+
+// Estimated share of radio time spent in connection events, in permille.
+// 0 without CONFIG_APP_SCAN_ADAPTIVE.
+uint32_t scan_duty_link_load(void);
+
+#endif /* SCAN_DUTY_H_ */
@@ -0,0 +1,240 @@
+/* state_sync.c - Read a set of characteristic values in one ATT round trip */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/bluetooth/att.h>
+
+#include "state_sync.h"
+
+LOG_MODULE_REGISTER(state_sync, CONFIG_APP_STATE_SYNC_LOG_LEVEL);
+
+static const char *const mode_names[] = {
+	[STATE_SYNC_READ_MULT_VL] = "Read Multiple Variable Length",
+	[STATE_SYNC_READ_MULT] = "Read Multiple",
+	[STATE_SYNC_READ_SINGLE] = "Read",
+};
+
+static uint8_t read_func(struct bt_conn *conn, uint8_t err,
+			 struct bt_gatt_read_params *params,
+			 const void *data, uint16_t length);
+
+static void value_store(struct state_sync_value *value, const uint8_t *data, uint16_t length)
+{
+	value->data_len = MIN(length, sizeof(value->data));
+	memcpy(value->data, data, value->data_len);
+	value->valid = true;
+}
+
+static void sync_finish(struct bt_conn *conn, struct state_sync *sync)
+{
+	LOG_DBG("%u value(s) in %u round trip(s) with %s (err %d)", (unsigned int)sync->count,
+		sync->round_trips, mode_names[sync->mode], sync->err);
+
+	sync->busy = false;
+
+	if (sync->slot_held) {
+		sync->slot_held = false;
+		gatt_sched_done(&sync->op);
+	}
+
+	sync->done(conn, sync, sync->err);
+}
+
+// A multiple read only makes sense for more than one value
+static bool sync_single(const struct state_sync *sync)
+{
+	return sync->mode == STATE_SYNC_READ_SINGLE || sync->one_by_one || sync->count == 1;
+}
+
+static int sync_request(struct bt_conn *conn, struct state_sync *sync)
+{
+	int err;
+
+	sync->params.func = read_func;
+
+	for (;;) {
+		if (sync_single(sync)) {
+			sync->params.handle_count = 1;
+			sync->params.single.handle = sync->values[sync->idx].handle;
+			sync->params.single.offset = 0;
+		} else {
+			sync->params.handle_count = sync->count;
+			sync->params.multiple.handles = sync->handles;
+			sync->params.multiple.variable = sync->mode == STATE_SYNC_READ_MULT_VL;
+		}
+
+		err = bt_gatt_read(conn, &sync->params);
+		if (err != -ENOTSUP || sync_single(sync)) {
+			break;
+		}
+
+		// Procedure not built into the host, try the next one
+		sync->mode++;
+		LOG_DBG("Falling back to %s", mode_names[sync->mode]);
+	}
+
+	if (!err) {
+		sync->round_trips++;
+	}
+
+	return err;
+}
+
+// Read the value at sync->idx, or finish when there is none left
+static void sync_next(struct bt_conn *conn, struct state_sync *sync)
+{
+	int err;
+
+	if (sync->idx >= sync->count) {
+		sync_finish(conn, sync);
+		return;
+	}
+
+	err = sync_request(conn, sync);
+	if (err) {
+		sync->err = err;
+		sync_finish(conn, sync);
+	}
+}
+
+// Read Multiple: the values are concatenated, all but the last one at their profile length
+static void split_fixed(struct state_sync *sync, const uint8_t *data, uint16_t length)
+{
+	for (; sync->idx < sync->count && length; sync->idx++) {
+		struct state_sync_value *value = &sync->values[sync->idx];
+		uint16_t len = sync->idx == sync->count - 1 ? length : MIN(value->len, length);
+
+		value_store(value, data, len);
+		data += len;
+		length -= len;
+	}
+}
+
+static uint8_t read_func(struct bt_conn *conn, uint8_t err,
+			 struct bt_gatt_read_params *params,
+			 const void *data, uint16_t length)
+{
+	struct state_sync *sync = CONTAINER_OF(params, struct state_sync, params);
+
+	if (err && !sync_single(sync)) {
+		if (err == BT_ATT_ERR_NOT_SUPPORTED) {
+			// The peer does not know the procedure, not asked again on this link
+			sync->mode++;
+			LOG_DBG("Peer refused the read, falling back to %s", mode_names[sync->mode]);
+		} else {
+			// A multiple read fails as a whole, read the values one by one to see which
+			LOG_DBG("%s failed (err 0x%02x), reading values one by one",
+				mode_names[sync->mode], err);
+			sync->one_by_one = true;
+		}
+
+		sync->idx = 0;
+		sync_next(conn, sync);
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (sync_single(sync)) {
+		// Profile values fit in one PDU, no need for a long read
+		if (err) {
+			sync->err = sync->err ? sync->err : err;
+		} else if (data) {
+			value_store(&sync->values[sync->idx], data, length);
+		}
+
+		sync->idx++;
+		sync_next(conn, sync);
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (!data) {
+		// End of the response, anything missing did not fit into the MTU
+		if (sync->idx < sync->count) {
+			sync->err = -EMSGSIZE;
+		}
+		sync_finish(conn, sync);
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (sync->mode == STATE_SYNC_READ_MULT_VL) {
+		// Called once per value, in request order
+		if (sync->idx < sync->count) {
+			value_store(&sync->values[sync->idx++], data, length);
+		}
+	} else {
+		split_fixed(sync, data, length);
+	}
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static int issue(struct gatt_sched_op *op)
+{
+	struct state_sync *sync = CONTAINER_OF(op, struct state_sync, op);
+	int err;
+
+	// Set before the request, the response may be handled before it returns
+	sync->slot_held = true;
+
+	err = sync_request(op->conn, sync);
+	if (err) {
+		// The scheduler takes the slot back
+		sync->slot_held = false;
+		sync->err = err;
+		sync_finish(op->conn, sync);
+	}
+
+	return err;
+}
+
+void state_sync_init(struct state_sync *sync)
+{
+	gatt_sched_cancel(&sync->op);
+	(void)memset(sync, 0, sizeof(*sync));
+
+	sync->mode = STATE_SYNC_READ_MULT_VL;
+	gatt_sched_op_init(&sync->op, GATT_SCHED_PRIO_READ, issue);
+}
+
+int state_sync_start(struct bt_conn *conn, struct state_sync *sync,
+		     struct state_sync_value *values, size_t count, state_sync_done_t done)
+{
+	int err;
+
+	if (sync->busy) {
+		return -EBUSY;
+	}
+
+	if (!count || count > ARRAY_SIZE(sync->handles)) {
+		return -EINVAL;
+	}
+
+	sync->values = values;
+	sync->count = count;
+	sync->done = done;
+	sync->idx = 0;
+	sync->err = 0;
+	sync->one_by_one = false;
+	sync->round_trips = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		sync->handles[i] = values[i].handle;
+		values[i].valid = false;
+		values[i].data_len = 0;
+	}
+
+	sync->busy = true;
+
+	err = gatt_sched_submit(&sync->op, conn);
+	if (err) {
+		sync->busy = false;
+	}
+
+	return err;
+}
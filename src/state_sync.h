@@ -0,0 +1,78 @@
+/* state_sync.h - Read a set of characteristic values in one ATT round trip */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STATE_SYNC_H_
+#define STATE_SYNC_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "gatt_sched.h"
+
+// Largest value kept per characteristic, longer values are truncated
+#define STATE_SYNC_VALUE_MAX 8
+
+// One characteristic to read, filled in by the caller
+struct state_sync_value {
+	uint16_t handle;
+	// Length of the value as defined by its profile. Read Multiple (without
+	// variable length) relies on it to split the response.
+	uint8_t len;
+
+	// Result, valid is false if the value could not be read
+	bool valid;
+	uint8_t data_len;
+	uint8_t data[STATE_SYNC_VALUE_MAX];
+};
+
+// ATT procedure used, from the preferred one down. A peer that rejects one is
+// not asked again on the same link.
+enum state_sync_mode {
+	STATE_SYNC_READ_MULT_VL,
+	STATE_SYNC_READ_MULT,
+	STATE_SYNC_READ_SINGLE,
+};
+
+struct state_sync;
+
+// err is 0 if every value was read, otherwise the first error seen (an ATT
+// error code or negative errno). Values read before the error are still valid.
+typedef void (*state_sync_done_t)(struct bt_conn *conn, struct state_sync *sync, int err);
+
+struct state_sync {
+	struct bt_gatt_read_params params;
+	// Telemetry reads go out through the scheduler, one slot for the whole sync
+	struct gatt_sched_op op;
+	bool slot_held;
+	uint16_t handles[CONFIG_APP_STATE_SYNC_MAX_VALUES];
+
+	struct state_sync_value *values;
+	size_t count;
+	state_sync_done_t done;
+
+	enum state_sync_mode mode;
+	bool busy;
+	// A multiple read failed on a value, the rest of this sync reads them singly
+	bool one_by_one;
+	// Next value to fill in
+	size_t idx;
+	int err;
+	// ATT requests issued for the current sync
+	uint16_t round_trips;
+};
+
+// Prepare sync for a new link. Must be called before the first state_sync_start().
+void state_sync_init(struct state_sync *sync);
+
+// Read values[0..count-1], with Read Multiple Variable Length when the peer
+// supports it. The reads wait for the scheduler, behind colour writes and link
+// setup. done is called once all values are in, or with the error if the
+// reads could not be issued. Returns -EBUSY while a previous sync is still running.
+int state_sync_start(struct bt_conn *conn, struct state_sync *sync,
+		     struct state_sync_value *values, size_t count, state_sync_done_t done);
+
+#endif /* STATE_SYNC_H_ */
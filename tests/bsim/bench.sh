@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: Apache-2.0
+#
+# Runs the benchmark of the central against simulated bulbs in BabbleSim.
+# Build both images first, from the top of the sample:
+#
+#   west twister -T . -p nrf52_bsim
+#
+# Twister only builds the images, this script is what checks the baselines:
+# it exits non-zero unless the central logs "Benchmark PASS" before the
+# simulation ends, so CI has to run it after the build to gate on them.
+
+set -u
+
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must point at the BabbleSim build}"
+
+BOARD="${BOARD:-nrf52_bsim}"
+BOARD_TS="${BOARD//\//_}"
+# Has to match CONFIG_APP_FLEET_SIZE of the sample.bluetooth.central.bsim scenario
+PEERS="${PEERS:-4}"
+SIM_LENGTH_US="${SIM_LENGTH_US:-60e6}"
+SIM_ID="playbulb_bench_$$"
+
+bin="${BSIM_OUT_PATH}/bin"
+log="$(mktemp)"
+trap 'rm -f "${log}"' EXIT
+
+cd "${bin}" || exit 1
+
+pids=()
+
+"./bs_${BOARD_TS}_playbulb_central" -s="${SIM_ID}" -d=0 -rs=1 > "${log}" 2>&1 &
+pids+=($!)
+
+for ((d = 1; d <= PEERS; d++)); do
+	"./bs_${BOARD_TS}_playbulb_peripheral" -s="${SIM_ID}" -d="${d}" -rs="$((d + 1))" \
+		> /dev/null 2>&1 &
+	pids+=($!)
+done
+
+./bs_2G4_phy_v1 -s="${SIM_ID}" -D="$((PEERS + 1))" -sim_length="${SIM_LENGTH_US}" \
+	> /dev/null 2>&1 &
+pids+=($!)
+
+for pid in "${pids[@]}"; do
+	wait "${pid}"
+done
+
+cat "${log}"
+grep -q "Benchmark PASS" "${log}"
@@ -0,0 +1,126 @@
+/* main.c - Simulated Playbulb Candle for the BabbleSim benchmark */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/services/bas.h>
+
+LOG_MODULE_REGISTER(playbulb_peripheral, LOG_LEVEL_INF);
+
+#define BULB_SVC_UUID   0xFF02
+#define BULB_COLOR_UUID 0xFFFC
+
+// Drains by one percent per period so that the central gets level notifications
+#define BATTERY_PERIOD K_SECONDS(1)
+
+// White, red, green, blue, as on the real bulb
+static uint8_t color[4];
+
+static ssize_t read_color(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+			  uint16_t len, uint16_t offset)
+{
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, color, sizeof(color));
+}
+
+static ssize_t write_color(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+	if (offset) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+
+	if (len != sizeof(color)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	memcpy(color, buf, sizeof(color));
+
+	return len;
+}
+
+BT_GATT_SERVICE_DEFINE(bulb_svc,
+	BT_GATT_PRIMARY_SERVICE(BT_UUID_DECLARE_16(BULB_SVC_UUID)),
+	BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_16(BULB_COLOR_UUID),
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE |
+			       BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+			       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
+			       read_color, write_color, NULL),
+);
+
+static const struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	if (err) {
+		LOG_WRN("Connection from %s failed (err 0x%02x)", addr, err);
+		return;
+	}
+
+	LOG_INF("Connected: %s", addr);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	char addr[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+
+	LOG_INF("Disconnected: %s (reason 0x%02x)", addr, reason);
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+int main(void)
+{
+	uint8_t level = 100;
+	int err;
+
+	err = bt_enable(NULL);
+	if (err) {
+		LOG_ERR("Bluetooth init failed (err %d)", err);
+		return 0;
+	}
+
+	// Without BT_LE_ADV_OPT_ONE_TIME, advertising resumes after every disconnect
+	err = bt_le_adv_start(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE,
+					      BT_GAP_ADV_FAST_INT_MIN_2,
+					      BT_GAP_ADV_FAST_INT_MAX_2, NULL),
+			      ad, ARRAY_SIZE(ad), NULL, 0);
+	if (err) {
+		LOG_ERR("Advertising failed to start (err %d)", err);
+		return 0;
+	}
+
+	LOG_INF("Advertising as \"%s\"", CONFIG_BT_DEVICE_NAME);
+
+	for (;;) {
+		k_sleep(BATTERY_PERIOD);
+
+		level = level > 1 ? level - 1 : 100;
+		(void)bt_bas_set_battery_level(level);
+	}
+
+	return 0;
+}
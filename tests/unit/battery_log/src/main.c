@@ -0,0 +1,252 @@
+/* main.c - Unit tests of the battery level time series encoder */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "battery_log.c"
+
+#define HISTORY_LEN 600
+
+static const bt_addr_le_t bulb_addr = {
+	.type = BT_ADDR_LE_RANDOM,
+	.a.val = { 0x01, 0x02, 0x03, 0x04, 0x05, 0xC6 },
+};
+
+static struct {
+	int calls;
+	int err;
+	uint8_t index;
+	uint8_t data[BATTERY_LOG_EXPORT_MAX];
+	size_t len;
+} exported;
+
+static int capture_export(uint8_t index, const uint8_t *data, size_t len)
+{
+	exported.calls++;
+
+	if (exported.err) {
+		return exported.err;
+	}
+
+	exported.index = index;
+	memcpy(exported.data, data, len);
+	exported.len = len;
+
+	return 0;
+}
+
+// Levels of the records in buf into levels, their number into n
+static void decode(const uint8_t *buf, size_t len, uint8_t *levels, size_t max, size_t *n)
+{
+	uint8_t level = 0;
+
+	*n = 0;
+
+	zassert_true(!len || buf[0] == BATTERY_LOG_ABSOLUTE, "series starts with 0x%02x", buf[0]);
+
+	for (size_t p = 0; p < len; p++) {
+		uint8_t rec = buf[p];
+		size_t count = 1;
+
+		if ((rec & BATTERY_LOG_ABSOLUTE) == BATTERY_LOG_ABSOLUTE) {
+			zassert_equal(rec, BATTERY_LOG_ABSOLUTE, "bad record 0x%02x", rec);
+			zassert_true(p + 1 < len, "absolute record cut short");
+			level = buf[++p];
+		} else if (rec & BATTERY_LOG_DELTA) {
+			level += record_delta(rec);
+		} else {
+			count = rec + 1U;
+		}
+
+		zassert_true(*n + count <= max, "more samples than fit");
+		memset(&levels[*n], level, count);
+		*n += count;
+	}
+}
+
+// Steady, draining, jumping and unknown stretches, for runs, deltas and
+// absolute records
+static uint8_t level_at(uint32_t i)
+{
+	switch ((i / 40) % 4) {
+	case 0:
+		return 80;
+	case 1:
+		return 80 - (i % 40);
+	case 2:
+		return (i % 2) ? 10 : 90;
+	default:
+		return (i % 5) ? BATTERY_LOG_UNKNOWN : 40;
+	}
+}
+
+static void log_before(void *fixture)
+{
+	memset(series, 0, sizeof(series));
+	memset(&exported, 0, sizeof(exported));
+	seq = 0;
+	log_queue = &k_sys_work_q;
+	exporter = capture_export;
+}
+
+static void log_after(void *fixture)
+{
+	(void)k_work_cancel_delayable(&sample_work);
+	(void)k_work_cancel_delayable(&export_work);
+}
+
+ZTEST(battery_log, test_records)
+{
+	static const uint8_t levels[] = {
+		100, 100, 100, 99, 97, 97, 130, BATTERY_LOG_UNKNOWN, BATTERY_LOG_UNKNOWN, 50,
+	};
+	static const uint8_t expected[] = {
+		// 100, twice more
+		BATTERY_LOG_ABSOLUTE, 100, 0x01,
+		// -1, -2, then once more
+		BATTERY_LOG_DELTA | 0x3F, BATTERY_LOG_DELTA | 0x3E, 0x00,
+		// A step of 33 does not fit a delta, nor does anything next to unknown
+		BATTERY_LOG_ABSOLUTE, 130, BATTERY_LOG_ABSOLUTE, BATTERY_LOG_UNKNOWN, 0x00,
+		BATTERY_LOG_ABSOLUTE, 50,
+	};
+	struct series *s = &series[0];
+	uint8_t decoded[ARRAY_SIZE(levels)];
+	size_t n;
+
+	for (size_t i = 0; i < ARRAY_SIZE(levels); i++) {
+		append(s, levels[i]);
+	}
+
+	zassert_equal(s->len, sizeof(expected));
+	zassert_mem_equal(s->buf, expected, sizeof(expected));
+
+	decode(s->buf, s->len, decoded, ARRAY_SIZE(decoded), &n);
+	zassert_equal(n, ARRAY_SIZE(levels));
+	zassert_mem_equal(decoded, levels, sizeof(levels));
+}
+
+ZTEST(battery_log, test_run_limit)
+{
+	static const uint8_t expected[] = { BATTERY_LOG_ABSOLUTE, 42, BATTERY_LOG_RUN_MAX, 0x00 };
+	struct series *s = &series[0];
+
+	// One absolute record, a full run, and a new run for the last sample
+	for (int i = 0; i < 1 + (BATTERY_LOG_RUN_MAX + 1) + 1; i++) {
+		append(s, 42);
+	}
+
+	zassert_equal(s->len, sizeof(expected));
+	zassert_mem_equal(s->buf, expected, sizeof(expected));
+}
+
+ZTEST(battery_log, test_compact_keeps_latest)
+{
+	static uint8_t history[HISTORY_LEN];
+	static uint8_t decoded[HISTORY_LEN];
+	struct series *s = &series[0];
+	bool compacted = false;
+
+	for (uint32_t i = 0; i < HISTORY_LEN; i++) {
+		size_t n;
+
+		history[i] = level_at(i);
+		append(s, history[i]);
+
+		zassert_true(s->len <= CONFIG_APP_BATTERY_LOG_BYTES, "series over its size");
+
+		// What is left are the newest samples, numbered on from the first record
+		decode(s->buf, s->len, decoded, ARRAY_SIZE(decoded), &n);
+		zassert_equal(s->first_seq + n, i + 1, "sample %u: %zu from %u", i, n, s->first_seq);
+		zassert_mem_equal(decoded, &history[i + 1 - n], n, "sample %u decodes wrong", i);
+
+		compacted |= s->first_seq > 0;
+	}
+
+	zassert_true(compacted, "series never filled up");
+}
+
+ZTEST(battery_log, test_export_format)
+{
+	struct series *s = &series[1];
+	uint8_t buf[BATTERY_LOG_EXPORT_MAX];
+	size_t len;
+
+	bt_addr_le_copy(&s->addr, &bulb_addr);
+	s->first_seq = 0x01020304;
+	append(s, 55);
+	append(s, 54);
+
+	len = encode(s, buf);
+
+	zassert_equal(len, BATTERY_LOG_HDR_LEN + 3);
+	zassert_equal(buf[0], BT_ADDR_LE_RANDOM);
+	zassert_mem_equal(&buf[1], bulb_addr.a.val, sizeof(bulb_addr.a.val));
+	zassert_equal(sys_get_le32(&buf[7]), 0x01020304);
+	zassert_equal(sys_get_le16(&buf[11]), CONFIG_APP_BATTERY_LOG_PERIOD_S);
+	zassert_mem_equal(&buf[BATTERY_LOG_HDR_LEN], s->buf, s->len);
+}
+
+ZTEST(battery_log, test_link_loss_keeps_series)
+{
+	static const uint8_t expected[] = { 70, BATTERY_LOG_UNKNOWN, 69 };
+	uint8_t decoded[8];
+	size_t n;
+
+	seq = 5;
+	battery_log_start(0, &bulb_addr);
+	battery_log_update(0, 70);
+	sample_handler(NULL);
+
+	// Without the link the gap is logged, and the series carries on after it
+	battery_log_stop(0);
+	sample_handler(NULL);
+	battery_log_start(0, &bulb_addr);
+	battery_log_update(0, 69);
+	sample_handler(NULL);
+
+	zassert_equal(series[0].first_seq, 5);
+	decode(series[0].buf, series[0].len, decoded, ARRAY_SIZE(decoded), &n);
+	zassert_equal(n, ARRAY_SIZE(expected));
+	zassert_mem_equal(decoded, expected, sizeof(expected));
+
+	// Nothing is logged for bulb 1, which never got a link
+	zassert_equal(series[1].len, 0);
+}
+
+ZTEST(battery_log, test_export_after_host_busy)
+{
+	battery_log_start(1, &bulb_addr);
+	battery_log_update(1, 90);
+	sample_handler(NULL);
+
+	// The host link is busy: the series is kept for the retry
+	exported.err = -ENOMEM;
+	export_work_handler(NULL);
+	zassert_equal(exported.calls, 1);
+	zassert_equal(series[1].len, 2);
+
+	exported.err = 0;
+	export_work_handler(NULL);
+	zassert_equal(exported.calls, 2);
+	zassert_equal(exported.index, 1);
+	zassert_equal(exported.len, BATTERY_LOG_HDR_LEN + 2);
+	zassert_equal(exported.data[BATTERY_LOG_HDR_LEN + 1], 90);
+
+	// Exported, so the next sample starts a new series
+	zassert_equal(series[1].len, 0);
+	zassert_equal(series[1].first_seq, seq);
+
+	// Once stopped and exported, a bulb is no longer sampled
+	battery_log_stop(1);
+	sample_handler(NULL);
+	zassert_equal(series[1].len, 0);
+}
+
+ZTEST_SUITE(battery_log, NULL, NULL, log_before, log_after, NULL);
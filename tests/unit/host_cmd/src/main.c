@@ -0,0 +1,248 @@
+/* main.c - Unit tests of the binary host command link */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/ztest.h>
+
+#include "host_cmd.h"
+
+#define QUEUE_DEPTH CONFIG_APP_HOST_CMD_QUEUE_DEPTH
+
+// Long enough for the emulator to deliver the bytes and the queue to run the commands
+#define SETTLE K_MSEC(5)
+
+#define ACK_LEN 5
+
+static const struct device *const host_uart = DEVICE_DT_GET(DT_CHOSEN(app_host_uart));
+
+static struct host_cmd executed[2 * QUEUE_DEPTH];
+static size_t executed_count;
+
+static void record_exec(const struct host_cmd *cmd)
+{
+	if (executed_count < ARRAY_SIZE(executed)) {
+		executed[executed_count] = *cmd;
+	}
+	executed_count++;
+}
+
+static void send_raw(const uint8_t *data, size_t len)
+{
+	zassert_equal(uart_emul_put_rx_data(host_uart, data, len), len);
+	k_sleep(SETTLE);
+}
+
+static void send_frame(uint8_t seq, const uint8_t *cmds, size_t len, uint8_t crc_flip)
+{
+	uint8_t frame[64];
+
+	zassert_true(len + 4 <= sizeof(frame));
+
+	frame[0] = HOST_CMD_SOF;
+	frame[1] = seq;
+	frame[2] = len;
+	memcpy(&frame[3], cmds, len);
+	frame[3 + len] = crc8_ccitt(0, &frame[1], len + 2) ^ crc_flip;
+
+	send_raw(frame, len + 4);
+}
+
+static void expect_ack(uint8_t seq, uint8_t status, uint8_t accepted)
+{
+	uint8_t ack[ACK_LEN + 1];
+
+	zassert_equal(uart_emul_get_tx_data(host_uart, ack, sizeof(ack)), ACK_LEN);
+	zassert_equal(ack[0], HOST_CMD_ACK_SOF);
+	zassert_equal(ack[1], seq);
+	zassert_equal(ack[2], status, "status %u, expected %u", ack[2], status);
+	zassert_equal(ack[3], accepted, "%u accepted, expected %u", ack[3], accepted);
+	zassert_equal(ack[4], crc8_ccitt(0, &ack[1], 3), "bad ack CRC");
+}
+
+static int init_err;
+
+static void *host_cmd_setup(void)
+{
+	init_err = host_cmd_init(&k_sys_work_q, record_exec);
+
+	return NULL;
+}
+
+static void host_cmd_before(void *fixture)
+{
+	uint8_t buf[16];
+
+	zassert_ok(init_err, "link not started");
+
+	while (uart_emul_get_tx_data(host_uart, buf, sizeof(buf))) {
+	}
+
+	memset(executed, 0, sizeof(executed));
+	executed_count = 0;
+}
+
+ZTEST(host_cmd, test_set_color)
+{
+	const uint8_t cmds[] = { HOST_CMD_SET_COLOR, 1, 0x00, 0xFF, 0x80, 0x01 };
+
+	send_frame(7, cmds, sizeof(cmds), 0);
+
+	expect_ack(7, HOST_CMD_OK, 1);
+	zassert_equal(executed_count, 1);
+	zassert_equal(executed[0].opcode, HOST_CMD_SET_COLOR);
+	zassert_equal(executed[0].peer, 1);
+	zassert_mem_equal(executed[0].args, &cmds[2], 4);
+}
+
+ZTEST(host_cmd, test_frame_across_buffers)
+{
+	const uint8_t frame[] = {
+		HOST_CMD_SOF, 1, 2, HOST_CMD_READ_STATE, 0,
+	};
+	const uint8_t crc = crc8_ccitt(0, &frame[1], sizeof(frame) - 1);
+	uint8_t ack[ACK_LEN];
+
+	// Parsed as it streams in, the CRC arriving in a later buffer
+	send_raw(frame, sizeof(frame));
+	zassert_equal(uart_emul_get_tx_data(host_uart, ack, sizeof(ack)), 0, "acked early");
+	send_raw(&crc, 1);
+
+	expect_ack(1, HOST_CMD_OK, 1);
+	zassert_equal(executed_count, 1);
+}
+
+ZTEST(host_cmd, test_bad_crc)
+{
+	const uint8_t cmds[] = { HOST_CMD_SET_COLOR, 0, 0x00, 0xFF, 0x00, 0x00 };
+	struct host_cmd_stats before, after;
+
+	host_cmd_get_stats(&before);
+	send_frame(2, cmds, sizeof(cmds), 0x01);
+	host_cmd_get_stats(&after);
+
+	expect_ack(2, HOST_CMD_ERR_CRC, 0);
+	zassert_equal(executed_count, 0);
+	zassert_equal(after.bad_frames, before.bad_frames + 1);
+	zassert_equal(after.frames, before.frames);
+}
+
+ZTEST(host_cmd, test_unknown_opcode)
+{
+	const uint8_t cmds[] = { HOST_CMD_READ_STATE, 0, 0x09, 0 };
+
+	send_frame(3, cmds, sizeof(cmds), 0);
+
+	expect_ack(3, HOST_CMD_ERR_FORMAT, 0);
+	zassert_equal(executed_count, 0, "part of a malformed frame ran");
+}
+
+ZTEST(host_cmd, test_args_past_frame_end)
+{
+	const uint8_t cmds[] = { HOST_CMD_SET_COLOR, 0, 0x00, 0xFF };
+
+	send_frame(4, cmds, sizeof(cmds), 0);
+
+	expect_ack(4, HOST_CMD_ERR_FORMAT, 0);
+	zassert_equal(executed_count, 0);
+}
+
+ZTEST(host_cmd, test_bad_peer)
+{
+	const uint8_t cmds[] = {
+		HOST_CMD_READ_STATE, 0,
+		HOST_CMD_READ_STATE, CONFIG_BT_MAX_CONN,
+	};
+
+	send_frame(5, cmds, sizeof(cmds), 0);
+
+	expect_ack(5, HOST_CMD_ERR_FORMAT, 0);
+	zassert_equal(executed_count, 0);
+}
+
+ZTEST(host_cmd, test_broadcast_runs_first)
+{
+	const uint8_t cmds[] = {
+		HOST_CMD_SET_COLOR, 2, 0x00, 0x00, 0xFF, 0x00,
+		HOST_CMD_SET_COLOR, HOST_CMD_PEER_ALL, 0x00, 0xFF, 0x00, 0x00,
+		HOST_CMD_DISCONNECT, 0,
+	};
+
+	send_frame(6, cmds, sizeof(cmds), 0);
+
+	expect_ack(6, HOST_CMD_OK, 3);
+	zassert_equal(executed_count, 3);
+	zassert_equal(executed[0].peer, HOST_CMD_PEER_ALL);
+	zassert_mem_equal(executed[0].args, &cmds[8], 4);
+	zassert_equal(executed[1].peer, 0);
+	zassert_equal(executed[1].opcode, HOST_CMD_DISCONNECT);
+	zassert_equal(executed[2].peer, 2);
+	zassert_mem_equal(executed[2].args, &cmds[2], 4);
+}
+
+ZTEST(host_cmd, test_queue_full)
+{
+	uint8_t cmds[2 * (QUEUE_DEPTH + 1)];
+	struct host_cmd_stats before, after;
+
+	for (size_t i = 0; i < sizeof(cmds); i += 2) {
+		cmds[i] = HOST_CMD_READ_STATE;
+		cmds[i + 1] = 3;
+	}
+
+	host_cmd_get_stats(&before);
+	send_frame(8, cmds, sizeof(cmds), 0);
+	host_cmd_get_stats(&after);
+
+	// The commands that fit still run
+	expect_ack(8, HOST_CMD_ERR_FULL, QUEUE_DEPTH);
+	zassert_equal(executed_count, QUEUE_DEPTH);
+	zassert_equal(after.dropped, before.dropped + 1);
+
+	// and free their slots again
+	send_frame(9, cmds, 2, 0);
+	expect_ack(9, HOST_CMD_OK, 1);
+}
+
+ZTEST(host_cmd, test_resync_after_noise)
+{
+	const uint8_t noise[] = { 0x00, 0x13, HOST_CMD_ACK_SOF, 0xFF };
+	const uint8_t cmds[] = { HOST_CMD_DISCONNECT, 1 };
+
+	send_raw(noise, sizeof(noise));
+	send_frame(10, cmds, sizeof(cmds), 0);
+
+	expect_ack(10, HOST_CMD_OK, 1);
+	zassert_equal(executed[0].opcode, HOST_CMD_DISCONNECT);
+}
+
+ZTEST(host_cmd, test_event_frame)
+{
+	const uint8_t data[] = { 0x00, 0xFF, 0x00, 0x00, 87 };
+	uint8_t big[HOST_CMD_EVT_DATA_MAX + 1] = { 0 };
+	uint8_t frame[sizeof(data) + 6];
+
+	zassert_ok(host_cmd_event(HOST_EVT_STATE, 3, data, sizeof(data)));
+	k_sleep(SETTLE);
+
+	zassert_equal(uart_emul_get_tx_data(host_uart, frame, sizeof(frame)), sizeof(data) + 5);
+	zassert_equal(frame[0], HOST_CMD_EVT_SOF);
+	zassert_equal(frame[1], HOST_EVT_STATE);
+	zassert_equal(frame[2], 3);
+	zassert_equal(frame[3], sizeof(data));
+	zassert_mem_equal(&frame[4], data, sizeof(data));
+	zassert_equal(frame[4 + sizeof(data)], crc8_ccitt(0, &frame[1], 3 + sizeof(data)));
+
+	zassert_equal(host_cmd_event(HOST_EVT_STATE, 3, big, sizeof(big)), -EMSGSIZE);
+}
+
+ZTEST_SUITE(host_cmd, NULL, host_cmd_setup, host_cmd_before, NULL, NULL);
@@ -0,0 +1,137 @@
+/* main.c - Unit tests of the bring-up retry policy */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include <zephyr/bluetooth/att.h>
+#include <zephyr/bluetooth/hci.h>
+
+#include "recovery.h"
+
+// Enough rounds for the jitter to spread every delay
+#define ROUNDS 200
+
+// The last attempts are the ones checking the cap
+BUILD_ASSERT((CONFIG_APP_RECOVERY_BASE_MS << (CONFIG_APP_RECOVERY_ATTEMPTS - 1)) >
+	     CONFIG_APP_RECOVERY_MAX_MS, "backoff never reaches the cap");
+
+static struct recovery rec;
+static atomic_t fired;
+
+static void retry_handler(struct k_work *work)
+{
+	atomic_inc(&fired);
+}
+
+static uint32_t backoff_ms(uint8_t attempt)
+{
+	return MIN((uint32_t)CONFIG_APP_RECOVERY_BASE_MS << attempt,
+		   (uint32_t)CONFIG_APP_RECOVERY_MAX_MS);
+}
+
+static void recovery_before(void *fixture)
+{
+	recovery_init(&rec, retry_handler);
+	atomic_clear(&fired);
+}
+
+static void recovery_after(void *fixture)
+{
+	recovery_reset(&rec);
+}
+
+ZTEST(recovery, test_transient_errors)
+{
+	zassert_true(recovery_transient(-ENOMEM));
+	zassert_true(recovery_transient(-EBUSY));
+	zassert_true(recovery_transient(-EAGAIN));
+	zassert_true(recovery_transient(BT_ATT_ERR_INSUFFICIENT_RESOURCES));
+
+	zassert_false(recovery_transient(0));
+	zassert_false(recovery_transient(-EINVAL));
+	zassert_false(recovery_transient(-ENOTCONN));
+	zassert_false(recovery_transient(BT_ATT_ERR_ATTRIBUTE_NOT_FOUND));
+	zassert_false(recovery_transient(BT_ATT_ERR_AUTHENTICATION));
+}
+
+ZTEST(recovery, test_hci_transient_reasons)
+{
+	zassert_true(recovery_hci_transient(BT_HCI_ERR_CONN_FAIL_TO_ESTAB));
+	zassert_true(recovery_hci_transient(BT_HCI_ERR_MEM_CAPACITY_EXCEEDED));
+
+	zassert_false(recovery_hci_transient(BT_HCI_ERR_SUCCESS));
+	zassert_false(recovery_hci_transient(BT_HCI_ERR_UNKNOWN_CONN_ID));
+	zassert_false(recovery_hci_transient(BT_HCI_ERR_REMOTE_USER_TERM_CONN));
+	zassert_false(recovery_hci_transient(BT_HCI_ERR_ADV_TIMEOUT));
+}
+
+ZTEST(recovery, test_backoff_bounds)
+{
+	uint32_t lowest[CONFIG_APP_RECOVERY_ATTEMPTS];
+	uint32_t highest[CONFIG_APP_RECOVERY_ATTEMPTS] = { 0 };
+
+	for (size_t i = 0; i < ARRAY_SIZE(lowest); i++) {
+		lowest[i] = UINT32_MAX;
+	}
+
+	for (int round = 0; round < ROUNDS; round++) {
+		for (uint8_t i = 0; i < CONFIG_APP_RECOVERY_ATTEMPTS; i++) {
+			uint32_t d = backoff_ms(i);
+			int delay = recovery_retry(&rec, &k_sys_work_q);
+
+			zassert_true(delay >= 0, "attempt %u failed with %d", i, delay);
+			zassert_true((uint32_t)delay >= d - d / 2 && (uint32_t)delay <= d,
+				     "attempt %u: %d ms outside [%u, %u]", i, delay, d - d / 2, d);
+
+			lowest[i] = MIN(lowest[i], (uint32_t)delay);
+			highest[i] = MAX(highest[i], (uint32_t)delay);
+		}
+
+		recovery_reset(&rec);
+	}
+
+	for (uint8_t i = 0; i < CONFIG_APP_RECOVERY_ATTEMPTS; i++) {
+		zassert_true(lowest[i] < highest[i], "attempt %u has no jitter", i);
+	}
+}
+
+ZTEST(recovery, test_budget_exhausted)
+{
+	for (uint8_t i = 0; i < CONFIG_APP_RECOVERY_ATTEMPTS; i++) {
+		zassert_true(recovery_retry(&rec, &k_sys_work_q) >= 0);
+	}
+
+	zassert_equal(recovery_retry(&rec, &k_sys_work_q), -EAGAIN);
+	zassert_equal(recovery_retry(&rec, &k_sys_work_q), -EAGAIN);
+
+	// A reset starts over at the first delay
+	recovery_reset(&rec);
+	zassert_true(recovery_retry(&rec, &k_sys_work_q) <= CONFIG_APP_RECOVERY_BASE_MS);
+}
+
+ZTEST(recovery, test_handler_runs_after_backoff)
+{
+	int delay = recovery_retry(&rec, &k_sys_work_q);
+
+	zassert_true(delay >= 0);
+	zassert_equal(atomic_get(&fired), 0, "handler ran before the backoff");
+
+	k_sleep(K_MSEC(delay + 1));
+	zassert_equal(atomic_get(&fired), 1);
+}
+
+ZTEST(recovery, test_reset_cancels_retry)
+{
+	zassert_true(recovery_retry(&rec, &k_sys_work_q) >= 0);
+	recovery_reset(&rec);
+
+	k_sleep(K_MSEC(CONFIG_APP_RECOVERY_MAX_MS + 1));
+	zassert_equal(atomic_get(&fired), 0, "cancelled retry still ran");
+}
+
+ZTEST_SUITE(recovery, NULL, NULL, recovery_before, recovery_after, NULL);